@@ -0,0 +1,177 @@
+// Per-run cost of reset + classify + claim on a mostly-empty map, against
+// the byte-at-a-time loops the scan kernels replaced. Before timing, the
+// block-scan and dirty-list paths are checked against those loops on
+// random maps.
+//
+//   coverage_bench [edges-hit] [passes]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <unistd.h>
+#include <vector>
+#include <sys/mman.h>
+
+#include "coverage.h"
+
+namespace {
+constexpr size_t kMapSize = kCovDefaultSize;
+constexpr int kCheckMaps = 200;
+
+uint8_t bucket_of(const uint8_t c) {
+    if (c <= 3) {
+        return c == 3 ? 4 : c;
+    }
+    return static_cast<uint8_t>(
+        8 << ((c >= 8) + (c >= 16) + (c >= 32) + (c >= 128)));
+}
+
+// The pre-kernel path: memset, then one pass per byte to bucket the hit
+// counts and another to compare and merge them into the virgin bits.
+size_t naive_run(uint8_t* map, const std::vector<uint32_t>& hits,
+                 uint8_t* virgin, std::vector<uint32_t>* out) {
+    std::memset(map, 0, kMapSize);
+    for (const uint32_t i : hits) {
+        ++map[i];
+    }
+    for (size_t i = 0; i < kMapSize; ++i) {
+        if (map[i]) {
+            map[i] = bucket_of(map[i]);
+        }
+    }
+    size_t fresh = 0;
+    for (size_t i = 0; i < kMapSize; ++i) {
+        if (map[i] & ~virgin[i]) {
+            virgin[i] |= map[i];
+            ++fresh;
+            if (out) {
+                out->push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+    return fresh;
+}
+
+// Plays the runtime: bumps each hit counter and lists first hits in the
+// header, flagging overflow once the list is full. dense sets the flag
+// up front, which forces the block-scan path.
+void fake_run(CovHeader* hdr, uint8_t* map, const std::vector<uint32_t>& hits,
+              const bool dense) {
+    hdr->overflow = dense;
+    for (const uint32_t i : hits) {
+        if (!map[i]++ && !hdr->overflow) {
+            if (hdr->dirty_count < kCovDirtyCap) {
+                hdr->dirty[hdr->dirty_count++] = i;
+            } else {
+                hdr->overflow = 1;
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> random_hits(std::mt19937& rng, const size_t edges) {
+    std::vector<uint32_t> hits;
+    for (size_t i = 0; i < edges; ++i) {
+        const uint32_t idx = rng() % kMapSize;
+        for (uint32_t k = rng() % 4 + 1; k; --k) {
+            hits.push_back(idx);
+        }
+    }
+    return hits;
+}
+
+// Feeds the same run sequence to both claim paths and the byte loops;
+// since the virgin bits carry over, a bad merge shows up in a later run.
+// Runs past kCovDirtyCap first hits take the block scan either way.
+bool check(Coverage& cov, CovHeader* hdr, uint8_t* map, std::mt19937& rng) {
+    std::vector<uint8_t> naive_map(kMapSize), naive_virgin(kMapSize);
+    VirginMap virgin[2];
+    for (int r = 0; r < kCheckMaps; ++r) {
+        const std::vector<uint32_t> hits =
+            random_hits(rng, rng() % (2 * kCovDirtyCap));
+        std::vector<uint32_t> want;
+        const size_t n = naive_run(naive_map.data(), hits,
+                                   naive_virgin.data(), &want);
+        for (const bool dense : {true, false}) {
+            std::vector<uint32_t> got;
+            cov.reset();
+            fake_run(hdr, map, hits, dense);
+            cov.classify();
+            const CovDelta d = cov.claim(virgin[dense], &got);
+            std::sort(got.begin(), got.end());
+            if (d.new_edges + d.new_buckets != n || got != want) {
+                std::fprintf(stderr, "%s and byte loops differ on map %d\n",
+                             dense ? "block scan" : "dirty list", r);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename F>
+void bench(const char* name, const int passes, F&& f) {
+    const auto t0 = std::chrono::steady_clock::now();
+    size_t acc = 0;
+    for (int i = 0; i < passes; ++i) {
+        acc += f();
+    }
+    const std::chrono::duration<double, std::micro> dt =
+        std::chrono::steady_clock::now() - t0;
+    std::printf("%-22s %8.2f us/run  (%zu)\n", name, dt.count() / passes,
+                acc);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t edges = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 300;
+    const int passes = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    Coverage::set_map_size(kMapSize);
+    Coverage cov;
+    if (!cov.setup()) {
+        return 1;
+    }
+    const int fd = shm_open(cov.shm_name().c_str(), O_RDWR, 0600);
+    void* shm = fd < 0 ? MAP_FAILED
+                       : mmap(nullptr, kCovHdrSize + kMapSize,
+                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        std::perror("map coverage shm");
+        return 1;
+    }
+    auto* hdr = static_cast<CovHeader*>(shm);
+    uint8_t* map = static_cast<uint8_t*>(shm) + kCovHdrSize;
+
+    std::mt19937 rng(1);
+    if (!check(cov, hdr, map, rng)) {
+        return 1;
+    }
+    const std::vector<uint32_t> hits = random_hits(rng, edges);
+
+    std::printf("%zu-byte map, %zu edges hit, kernel %s, %d maps checked\n",
+                kMapSize, edges, Coverage::kernel_name(), kCheckMaps);
+    std::vector<uint8_t> naive_map(kMapSize), naive_virgin(kMapSize);
+    bench("byte loops", passes, [&] {
+        return naive_run(naive_map.data(), hits, naive_virgin.data(),
+                         nullptr);
+    });
+    for (const bool dense : {true, false}) {
+        VirginMap virgin;
+        cov.reset();
+        bench(dense ? "block scan" : "dirty list", passes, [&] {
+            cov.reset();
+            fake_run(hdr, map, hits, dense);
+            cov.classify();
+            const CovDelta d = cov.claim(virgin);
+            return d.new_edges + d.new_buckets;
+        });
+    }
+    munmap(shm, kCovHdrSize + kMapSize);
+    close(fd);
+    return 0;
+}
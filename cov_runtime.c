@@ -1,17 +1,282 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 static const char* SHM_ENV_VAR = "__FUZZ_SHARE";
-static const size_t COV_MAP_SIZE = 1 << 17;
+static const char* FORKSRV_ENV_VAR = "__FUZZ_FORKSRV";
+static const char* INPUT_ENV_VAR = "__FUZZ_INPUT";
+static const char* PERSIST_ENV_VAR = "__FUZZ_PERSIST";
+static const char* INPUT_BACK_ENV_VAR = "__FUZZ_INPUT_BACK";
+static const char* CMPLOG_ENV_VAR = "__FUZZ_CMPLOG";
+static const size_t COV_MAP_MIN = 1 << 12;
+static const size_t COV_MAP_MAX = 1 << 21;
+static const size_t COV_VALUE_SIZE = 1 << 16;
+static const uint32_t COV_DIRTY_CAP = 4096;
+static const size_t COV_HDR_SIZE = 64 + 4 * 4096;
+static const size_t INPUT_HDR_SIZE = 64;
+static const int INPUT_FILE_FD = 197;
+static const int INPUT_BACK_STDIN = 1;
+static const int INPUT_BACK_FILE = 2;
+static const int FORKSRV_FD = 198;
+static const uint32_t FORKSRV_HELLO = 0x46535256;
 
+/* Shm layout: this header, then the edge map. Each edge's first hit in a
+ * run appends its index to dirty[]; past COV_DIRTY_CAP the list is
+ * abandoned and overflow tells the fuzzer to scan the whole map. The
+ * target reports its guard count (or inline counter count, with counters
+ * set); the fuzzer picks map_size from it. With value_profile set,
+ * compare-distance features follow the edge map. */
+struct cov_header {
+    uint32_t dirty_count;
+    uint32_t overflow;
+    uint32_t guard_count;
+    uint32_t map_size;
+    uint32_t value_profile;
+    uint32_t counters;
+    uint32_t func_count;
+    uint32_t reserved[9];
+    uint32_t dirty[];
+};
+
+/* Cmp-log shm: one slot per compare site, hashed from its return address,
+ * keeping the last CMP_DEPTH operand pairs that differed. */
+enum { CMP_SITES = 4096, CMP_DEPTH = 8 };
+
+/* Inline 8-bit counter sections, one per instrumented module. */
+enum { CNTR_REGIONS = 64 };
+
+struct cntr_region {
+    uint8_t* start;
+    uint8_t* stop;
+};
+
+struct cmp_site {
+    uint32_t hits;
+    uint32_t size;
+    uint64_t ops[CMP_DEPTH][2];
+};
+
+/* The runtime is linked into instrumented targets, so every function in
+ * it carries NO_COVERAGE: its own edges and compares, the fork server's in
+ * particular, must never reach the map or the compare hooks. */
+#if defined(__clang__)
+#define NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#else
+#define NO_COVERAGE __attribute__((no_sanitize_coverage))
+#endif
+
+static struct cov_header* cov_hdr = NULL;
 static uint8_t* cov_area_ptr = NULL;
+static size_t cov_map_size = 1 << 17;
+static size_t cov_span = 1 << 17;
+static int cov_values = 0;
 static __thread uint32_t cov_prev_loc = 0;
 static uint32_t unique_guard_id = 1;
+static int forksrv_started = 0;
+static struct cmp_site* cmp_sites = NULL;
+static struct cntr_region cntr_regions[CNTR_REGIONS];
+static unsigned int cntr_nregions = 0;
+static uint32_t cntr_total = 0;
+static uint32_t pc_funcs = 0;
+
+static uint8_t* input_ptr = NULL;
+static size_t input_cap = 0;
+static unsigned int persist_max = 0;
+static int input_back = 0;
+static int input_memfd = -1;
+
+static void __fuzz_input_back(void);
+static void __cov_flush_counters(void);
+static void __cov_zero_counters(void);
+
+NO_COVERAGE static void __cov_reset(void) {
+    if (!cov_hdr) {
+        return;
+    }
+    if (cov_hdr->overflow) {
+        memset(cov_area_ptr, 0, cov_span);
+    } else {
+        for (uint32_t i = 0; i < cov_hdr->dirty_count; i++) {
+            cov_area_ptr[cov_hdr->dirty[i]] = 0;
+        }
+    }
+    cov_hdr->dirty_count = 0;
+    cov_hdr->overflow = 0;
+}
+
+/* Targets that define this symbol as non-zero start the fork server from
+ * __fuzz_init() after their own setup instead of from the constructor. */
+extern const int __fuzz_defer_init __attribute__((weak));
+/* Provided by the sanitizer runtime when the target links one. */
+extern void __sanitizer_set_death_callback(void (*callback)(void))
+    __attribute__((weak));
+
+NO_COVERAGE static void __fuzz_forksrv(void) {
+    if (forksrv_started) {
+        return;
+    }
+    forksrv_started = 1;
+
+    const char* on = getenv(FORKSRV_ENV_VAR);
+    if (!on || !*on) {
+        return;
+    }
+    uint32_t msg = FORKSRV_HELLO;
+    if (write(FORKSRV_FD + 1, &msg, sizeof(msg)) != sizeof(msg)) {
+        return;
+    }
 
-__attribute__((constructor)) static void __cov_map_shm(void) {
+    pid_t child = -1;
+    int stopped = 0;
+    for (;;) {
+        if (read(FORKSRV_FD, &msg, sizeof(msg)) != sizeof(msg)) {
+            _exit(0);
+        }
+        if (stopped) {
+            stopped = 0;
+            kill(child, SIGCONT);
+        } else {
+            child = fork();
+            if (child < 0) {
+                _exit(1);
+            }
+            if (child == 0) {
+                close(FORKSRV_FD);
+                close(FORKSRV_FD + 1);
+                cov_prev_loc = 0;
+                __cov_zero_counters();
+                __fuzz_input_back();
+                return;
+            }
+        }
+        if (write(FORKSRV_FD + 1, &child, sizeof(child)) != sizeof(child)) {
+            _exit(1);
+        }
+        int status = 0;
+        if (waitpid(child, &status, persist_max ? WUNTRACED : 0) < 0) {
+            _exit(1);
+        }
+        stopped = WIFSTOPPED(status);
+        if (write(FORKSRV_FD + 1, &status, sizeof(status)) != sizeof(status)) {
+            _exit(1);
+        }
+    }
+}
+
+NO_COVERAGE void __fuzz_init(void) {
+    __fuzz_forksrv();
+}
+
+/* Persistent loop: the first call runs the testcase the child was forked
+ * for; every later call stops the process until the fork server resumes it
+ * with the next testcase. Returns 0 once max_iters runs are done. */
+NO_COVERAGE int __fuzz_loop(unsigned int max_iters) {
+    static unsigned int iter = 0;
+
+    unsigned int limit = max_iters;
+    if (persist_max && persist_max < limit) {
+        limit = persist_max;
+    }
+    if (iter == 0 || (persist_max && iter < limit)) {
+        __cov_flush_counters();
+        if (iter++) {
+            raise(SIGSTOP);
+            __fuzz_input_back();
+        }
+        __cov_reset();
+        cov_prev_loc = 0;
+        return 1;
+    }
+    return 0;
+}
+
+NO_COVERAGE const uint8_t* __fuzz_input(size_t* len) {
+    if (!input_ptr) {
+        *len = 0;
+        return NULL;
+    }
+    uint32_t n = *(volatile uint32_t*)input_ptr;
+    *len = n < input_cap ? n : input_cap;
+    return input_ptr + INPUT_HDR_SIZE;
+}
+
+NO_COVERAGE static void __fuzz_input_open(void) {
+    const char* shm_name = getenv(INPUT_ENV_VAR);
+    if (!shm_name || !*shm_name) {
+        return;
+    }
+    int fd = shm_open(shm_name, O_RDONLY, 0600);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= INPUT_HDR_SIZE) {
+        close(fd);
+        return;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    input_ptr = (uint8_t*)map;
+    input_cap = (size_t)st.st_size - INPUT_HDR_SIZE;
+
+    const char* persist = getenv(PERSIST_ENV_VAR);
+    if (persist && *persist) {
+        persist_max = (unsigned int)strtoul(persist, NULL, 10);
+    }
+    const char* back = getenv(INPUT_BACK_ENV_VAR);
+    if (back && *back) {
+        input_back = atoi(back);
+    }
+}
+
+/* Serves the shm testcase as stdin and/or /dev/fd/197 for targets that
+ * read files. One memfd is created up front and rewritten per run. */
+NO_COVERAGE static void __fuzz_input_back(void) {
+    if (!input_ptr || !input_back) {
+        return;
+    }
+    if (input_memfd < 0) {
+        input_memfd = memfd_create("fuzz_input", 0);
+        if (input_memfd < 0) {
+            return;
+        }
+    }
+    size_t len = 0;
+    const uint8_t* data = __fuzz_input(&len);
+    if (ftruncate(input_memfd, 0) < 0) {
+        return;
+    }
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = pwrite(input_memfd, data + off, len - off, (off_t)off);
+        if (w <= 0) {
+            return;
+        }
+        off += (size_t)w;
+    }
+    lseek(input_memfd, 0, SEEK_SET);
+    if (input_back & INPUT_BACK_STDIN) {
+        dup2(input_memfd, STDIN_FILENO);
+    }
+    if (input_back & INPUT_BACK_FILE) {
+        dup2(input_memfd, INPUT_FILE_FD);
+    }
+}
+
+NO_COVERAGE static void __cov_map_open(void) {
+    if (cov_hdr) {
+        return;
+    }
     const char* shm_name = getenv(SHM_ENV_VAR);
     if (!shm_name || !*shm_name) {
         return;
@@ -20,35 +285,274 @@ __attribute__((constructor)) static void __cov_map_shm(void) {
     if (fd < 0) {
         return;
     }
-    void* map = mmap(NULL, COV_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-                     0);
+    void* map = mmap(NULL, COV_HDR_SIZE + COV_MAP_MAX + COV_VALUE_SIZE,
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     close(fd);
     if (map == MAP_FAILED) {
         return;
     }
-    cov_area_ptr = (uint8_t*)map;
+    cov_hdr = (struct cov_header*)map;
+    cov_area_ptr = (uint8_t*)map + COV_HDR_SIZE;
+    size_t size = cov_hdr->map_size;
+    if (size >= COV_MAP_MIN && size <= COV_MAP_MAX && !(size & (size - 1))) {
+        cov_map_size = size;
+    }
+    cov_values = cov_hdr->value_profile != 0;
+    cov_span = cov_map_size + (cov_values ? COV_VALUE_SIZE : 0);
+}
+
+NO_COVERAGE static void __cmp_map_open(void) {
+    const char* shm_name = getenv(CMPLOG_ENV_VAR);
+    if (!shm_name || !*shm_name) {
+        return;
+    }
+    int fd = shm_open(shm_name, O_RDWR, 0600);
+    if (fd < 0) {
+        return;
+    }
+    void* map = mmap(NULL, CMP_SITES * sizeof(struct cmp_site),
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map != MAP_FAILED) {
+        cmp_sites = (struct cmp_site*)map;
+    }
 }
 
-void __sanitizer_cov_trace_pc_guard(const uint32_t* guard) {
+NO_COVERAGE __attribute__((constructor)) static void __cov_map_shm(void) {
+    __cov_map_open();
+    __cmp_map_open();
+    __fuzz_input_open();
+    __fuzz_input_back();
+    if (&__fuzz_defer_init && __fuzz_defer_init) {
+        return;
+    }
+    __fuzz_forksrv();
+}
+
+NO_COVERAGE static inline void __cov_first_hit(uintptr_t idx) {
+    uint32_t n = cov_hdr->dirty_count;
+    if (n < COV_DIRTY_CAP) {
+        cov_hdr->dirty[n] = (uint32_t)idx;
+        cov_hdr->dirty_count = n + 1;
+    } else {
+        cov_hdr->overflow = 1;
+    }
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_pc_guard(const uint32_t* guard) {
     if (!cov_area_ptr || !guard || !*guard) {
         return;
     }
 
     uint32_t guard_id = *guard;
     uintptr_t edge_index = (uintptr_t)cov_prev_loc ^ (uintptr_t)guard_id;
-    uintptr_t idx = edge_index & (COV_MAP_SIZE - 1);
-    cov_area_ptr[idx]++;
+    uintptr_t idx = edge_index & (cov_map_size - 1);
+    uint8_t c = cov_area_ptr[idx];
+    if (!c) {
+        __cov_first_hit(idx);
+    }
+    /* Saturate so a wrapped counter never looks like a first hit. */
+    if (c != 0xFF) {
+        cov_area_ptr[idx] = c + 1;
+    }
     cov_prev_loc = guard_id >> 1;
 }
 
-void __sanitizer_cov_trace_pc_guard_init(uint32_t* start,
-                                         const uint32_t* stop) {
+/* Sequential ids would keep every prev ^ cur index below the next power
+ * of two of the guard count; mixing them spreads edges over the map. */
+NO_COVERAGE static uint32_t __cov_guard_id(uint32_t n) {
+    n ^= n >> 16;
+    n *= 0x85ebca6bu;
+    n ^= n >> 13;
+    n *= 0xc2b2ae35u;
+    n ^= n >> 16;
+    return n ? n : 1;
+}
+
+/* Sanitizer module constructors may run before ours, so the map is opened
+ * here too to publish the guard count. */
+NO_COVERAGE void __sanitizer_cov_trace_pc_guard_init(uint32_t* start,
+                                                     const uint32_t* stop) {
     if (start == stop || !start) {
         return;
     }
     for (uint32_t* x = start; x < stop; x++) {
         if (!*x) {
-            *x = unique_guard_id++;
+            *x = __cov_guard_id(unique_guard_id++);
+        }
+    }
+    __cov_map_open();
+    if (cov_hdr) {
+        cov_hdr->guard_count = unique_guard_id - 1;
+    }
+}
+
+/* Value profile: 128 features per compare site, the Hamming distance of
+ * the operands and the bit length of their difference. Each is a plain
+ * flag, so reaching a new distance shows up as new coverage. */
+NO_COVERAGE static void __cov_value(uintptr_t pc, uint64_t a, uint64_t b) {
+    uint64_t diff = a > b ? a - b : b - a;
+    uintptr_t site = (pc ^ pc >> 12) & (COV_VALUE_SIZE / 128 - 1);
+    uintptr_t base = cov_map_size + (site << 7);
+    uintptr_t idx[2] = {
+        base + (uintptr_t)__builtin_popcountll(a ^ b) - 1,
+        base + 64 + (uintptr_t)(63 - __builtin_clzll(diff)),
+    };
+    for (int i = 0; i < 2; i++) {
+        if (!cov_area_ptr[idx[i]]) {
+            __cov_first_hit(idx[i]);
+            cov_area_ptr[idx[i]] = 1;
         }
     }
 }
+
+NO_COVERAGE static void __cmp_hook(uintptr_t pc, uint64_t a, uint64_t b,
+                                   uint32_t size) {
+    if (a == b) {
+        return;
+    }
+    if (cov_values && cov_area_ptr) {
+        __cov_value(pc, a, b);
+    }
+    if (!cmp_sites) {
+        return;
+    }
+    struct cmp_site* s = &cmp_sites[(pc ^ pc >> 12) & (CMP_SITES - 1)];
+    uint32_t slot = s->hits++ & (CMP_DEPTH - 1);
+    s->size = size;
+    s->ops[slot][0] = a;
+    s->ops[slot][1] = b;
+}
+
+#define CMP_PC ((uintptr_t)__builtin_return_address(0))
+
+NO_COVERAGE void __sanitizer_cov_trace_cmp1(uint8_t a, uint8_t b) {
+    __cmp_hook(CMP_PC, a, b, 1);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_cmp2(uint16_t a, uint16_t b) {
+    __cmp_hook(CMP_PC, a, b, 2);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_cmp4(uint32_t a, uint32_t b) {
+    __cmp_hook(CMP_PC, a, b, 4);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_cmp8(uint64_t a, uint64_t b) {
+    __cmp_hook(CMP_PC, a, b, 8);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_const_cmp1(uint8_t a, uint8_t b) {
+    __cmp_hook(CMP_PC, a, b, 1);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_const_cmp2(uint16_t a, uint16_t b) {
+    __cmp_hook(CMP_PC, a, b, 2);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_const_cmp4(uint32_t a, uint32_t b) {
+    __cmp_hook(CMP_PC, a, b, 4);
+}
+
+NO_COVERAGE void __sanitizer_cov_trace_const_cmp8(uint64_t a, uint64_t b) {
+    __cmp_hook(CMP_PC, a, b, 8);
+}
+
+/* cases[0] is the case count, cases[1] the operand width in bits; each
+ * case is logged as its own site. */
+NO_COVERAGE void __sanitizer_cov_trace_switch(uint64_t val,
+                                              uint64_t* cases) {
+    uint32_t size = (uint32_t)(cases[1] / 8);
+    for (uint64_t i = 0; i < cases[0]; i++) {
+        __cmp_hook(CMP_PC + i, val, cases[i + 2], size);
+    }
+}
+
+/* Inline counters are bumped in the target's own sections without any
+ * callback. At the end of a run the non-zero ones are copied into the map
+ * (regions back to back, saturating) and listed in dirty[]; the sections
+ * are then cleared for the next persistent iteration. The flush runs from
+ * __fuzz_loop, atexit and the sanitizer death callback, so exits, sanitizer
+ * reports and the signals the sanitizer handles are covered. A child killed
+ * outright, e.g. with SIGKILL on a timeout, never gets here and reports an
+ * empty map for that run. */
+NO_COVERAGE static void __cov_flush_counters(void) {
+    if (!cov_area_ptr) {
+        return;
+    }
+    uintptr_t base = 0;
+    for (unsigned int r = 0; r < cntr_nregions; r++) {
+        uint8_t* p = cntr_regions[r].start;
+        size_t n = (size_t)(cntr_regions[r].stop - p);
+        for (size_t i = 0; i < n; i++) {
+            if (i + 8 <= n) {
+                uint64_t w;
+                memcpy(&w, p + i, 8);
+                if (!w) {
+                    i += 7;
+                    continue;
+                }
+            }
+            if (!p[i]) {
+                continue;
+            }
+            uintptr_t idx = (base + i) & (cov_map_size - 1);
+            unsigned int c = cov_area_ptr[idx];
+            if (!c) {
+                __cov_first_hit(idx);
+            }
+            c += p[i];
+            cov_area_ptr[idx] = (uint8_t)(c > 0xFF ? 0xFF : c);
+            p[i] = 0;
+        }
+        base += n;
+    }
+}
+
+/* Forked children start from zero, not from the fork server's counts. */
+NO_COVERAGE static void __cov_zero_counters(void) {
+    for (unsigned int r = 0; r < cntr_nregions; r++) {
+        memset(cntr_regions[r].start, 0,
+               (size_t)(cntr_regions[r].stop - cntr_regions[r].start));
+    }
+}
+
+NO_COVERAGE void __sanitizer_cov_8bit_counters_init(uint8_t* start,
+                                                    uint8_t* stop) {
+    if (start == stop || !start || cntr_nregions == CNTR_REGIONS) {
+        return;
+    }
+    for (unsigned int r = 0; r < cntr_nregions; r++) {
+        if (cntr_regions[r].start == start) {
+            return;
+        }
+    }
+    if (!cntr_nregions) {
+        atexit(__cov_flush_counters);
+        if (__sanitizer_set_death_callback) {
+            __sanitizer_set_death_callback(__cov_flush_counters);
+        }
+    }
+    cntr_regions[cntr_nregions].start = start;
+    cntr_regions[cntr_nregions].stop = stop;
+    cntr_nregions++;
+    cntr_total += (uint32_t)(stop - start);
+    __cov_map_open();
+    if (cov_hdr) {
+        cov_hdr->guard_count = cntr_total;
+        cov_hdr->counters = 1;
+    }
+}
+
+/* pc-table entries pair each counter with its PC; flag bit 0 marks a
+ * function entry block. Only the function count is reported. */
+NO_COVERAGE void __sanitizer_cov_pcs_init(const uintptr_t* beg,
+                                          const uintptr_t* end) {
+    for (const uintptr_t* p = beg; p + 1 < end; p += 2) {
+        pc_funcs += (uint32_t)(p[1] & 1);
+    }
+    __cov_map_open();
+    if (cov_hdr) {
+        cov_hdr->func_count = pc_funcs;
+    }
+}
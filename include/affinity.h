@@ -0,0 +1,17 @@
+#ifndef FUZZ_AFFINITY_H
+#define FUZZ_AFFINITY_H
+
+#include <string>
+#include <vector>
+
+// Parses "0,2,4-7" into a sorted, de-duplicated list. Fails on anything
+// but digits, commas and ranges, and on CPUs at or past CPU_SETSIZE.
+bool parse_cpu_list(const std::string& s, std::vector<int>& out);
+
+// CPUs this process may run on that no other task has pinned itself to.
+std::vector<int> free_cpus();
+
+// Binds the calling thread, and the children it spawns, to one CPU.
+bool pin_thread(int cpu);
+
+#endif //FUZZ_AFFINITY_H
@@ -0,0 +1,78 @@
+#ifndef FUZZ_ASYNC_EXECUTOR_H
+#define FUZZ_ASYNC_EXECUTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "coverage.h"
+#include "executor.h"
+
+// Keeps up to `inflight` target runs going from a single thread. Each slot
+// owns its own Executor and coverage shm.
+class AsyncExecutor {
+public:
+    struct Job {
+        std::vector<uint8_t> input;
+        uint64_t tag = 0;
+        uint64_t parent = 0; // corpus id the input was derived from
+        ExecResult result;
+        Coverage cov;
+        size_t slot = 0;
+    };
+
+    AsyncExecutor(size_t inflight, const ExecConfig& cfg,
+                  std::vector<std::string> argv_t);
+    ~AsyncExecutor();
+
+    AsyncExecutor(const AsyncExecutor&) = delete;
+    AsyncExecutor& operator=(const AsyncExecutor&) = delete;
+
+    bool setup();
+
+    [[nodiscard]] bool can_submit() const { return !idle_.empty(); }
+    [[nodiscard]] size_t running() const { return running_; }
+
+    // Applies to runs submitted from now on.
+    void set_timeout_ms(int ms);
+
+    // Starts input on an idle slot; false if every slot is busy.
+    bool submit(std::vector<uint8_t> input, uint64_t tag,
+                uint64_t parent = 0);
+    // Blocks until a run finishes. The job stays untouched until release();
+    // returns nullptr when nothing is running.
+    Job* complete();
+    // Runs a held job's input again on its slot and waits for it; the
+    // job's coverage then shows the new run while result keeps the first.
+    ExecResult rerun(Job& job);
+    void release(const Job* job);
+
+private:
+    enum class State {
+        Idle,
+        Running,
+        Ready,
+        Held,
+    };
+
+    struct Slot {
+        Job job;
+        std::unique_ptr<Executor> exec;
+        State state = State::Idle;
+        bool watched = false;
+    };
+
+    void mark_ready(size_t idx);
+
+    size_t inflight_;
+    ExecConfig cfg_;
+    std::vector<std::string> argv_t_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<size_t> idle_;
+    std::vector<size_t> ready_;
+    size_t running_ = 0;
+    int epfd_ = -1;
+};
+
+#endif //FUZZ_ASYNC_EXECUTOR_H
@@ -0,0 +1,49 @@
+#ifndef FUZZ_CALIBRATION_H
+#define FUZZ_CALIBRATION_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "coverage.h"
+#include "executor.h"
+
+constexpr int kCalibRuns = 3;
+constexpr int kCalibLimitMs = 5000;
+constexpr int kHangVerifyMs = 1000;
+
+// Working timeout = kPercentile of corpus exec times * kMultiplier, clamped
+// to [kMinMs, kCalibLimitMs]. A fixed timeout ignores samples.
+class TimeoutTuner {
+public:
+    static constexpr int kPercentile = 95;
+    static constexpr int kMultiplier = 5;
+    static constexpr int kMinMs = 20;
+    static constexpr int kDefaultMs = 1000;
+
+    explicit TimeoutTuner(int fixed_ms);
+
+    void add_sample(uint64_t wall_us);
+    [[nodiscard]] int timeout_ms() const {
+        return ms_.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] bool fixed() const { return fixed_; }
+
+private:
+    mutable std::mutex mu_;
+    std::vector<uint64_t> samples_;
+    std::atomic<int> ms_;
+    bool fixed_;
+};
+
+// Runs every corpus entry kCalibRuns times, records its mean wall and CPU
+// time and the edges every run hit alike (cov is exec's map), and seeds the
+// tuner with the times.
+void calibrate_corpus(Corpus& corpus, Executor& exec, const Coverage& cov,
+                      const std::vector<std::string>& argv_t,
+                      TimeoutTuner& tuner);
+
+#endif //FUZZ_CALIBRATION_H
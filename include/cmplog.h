@@ -0,0 +1,52 @@
+#ifndef FUZZ_CMPLOG_H
+#define FUZZ_CMPLOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr char kCmpLogVar[] = "__FUZZ_CMPLOG";
+constexpr size_t kCmpSites = 4096;
+constexpr size_t kCmpDepth = 8;
+
+// One compare site in the cmp-log shm; mirrors struct cmp_site in
+// cov_runtime.c. ops keeps the last kCmpDepth differing operand pairs.
+struct CmpSite {
+    uint32_t hits;
+    uint32_t size;
+    uint64_t ops[kCmpDepth][2];
+};
+static_assert(sizeof(CmpSite) == 8 + kCmpDepth * 16);
+
+struct CmpPair {
+    uint64_t a = 0;
+    uint64_t b = 0;
+    uint32_t size = 0; // operand bytes: 1, 2, 4 or 8
+
+    auto operator<=>(const CmpPair&) const = default;
+};
+
+// Shm the runtime's trace-cmp hooks write operands into.
+class CmpLog {
+public:
+    CmpLog() = default;
+    ~CmpLog();
+    CmpLog(const CmpLog&) = delete;
+    CmpLog& operator=(const CmpLog&) = delete;
+
+    bool setup();
+    void reset();
+    // Distinct operand pairs logged since the last reset.
+    [[nodiscard]] std::vector<CmpPair> pairs() const;
+
+    [[nodiscard]] const std::string& shm_name() const {
+        return shm_name_;
+    }
+
+private:
+    int shm_id_ = -1;
+    CmpSite* sites_ = nullptr;
+    std::string shm_name_;
+};
+
+#endif //FUZZ_CMPLOG_H
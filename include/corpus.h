@@ -2,28 +2,99 @@
 #define FUZZ_CORPUS_H
 
 #include <cstdint>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
+// Corpus entries are immutable once added, so handles to them are shared
+// instead of copied.
+using Input = std::shared_ptr<const std::vector<uint8_t>>;
+
+inline Input make_input(std::vector<uint8_t> data) {
+    return std::make_shared<const std::vector<uint8_t>>(std::move(data));
+}
+
+// Every covered edge remembers the entry that reaches it cheapest
+// (exec time x size). A greedy pass over those picks a favored subset that
+// covers all rated edges; pick() strongly prefers it. At the cap, the entry
+// that is cheapest for the fewest edges makes room for the new one.
 class Corpus {
 public:
     explicit Corpus(size_t max_size_bytes, size_t max_items = 10000);
     bool load_dir(const std::string& dir);
-    void add(const std::vector<uint8_t>& item, uint32_t score = 1);
-    std::vector<uint8_t> pick();
+    // edges: the map indices this input covers, if known. Returns the id
+    // the entry keeps for its lifetime, or nullopt if the cap evicted the
+    // entry right away.
+    std::optional<uint64_t> add(Input item, uint32_t score = 1,
+                                uint32_t exec_us = 0, uint32_t cpu_us = 0,
+                                std::vector<uint32_t> edges = {});
+    // Re-adds an entry saved under id, e.g. from a resumed queue; later
+    // ids are handed out past it.
+    void restore(uint64_t id, Input item, uint32_t score, uint32_t exec_us,
+                 std::vector<uint32_t> edges);
+    // Ids handed out from now on are at least id.
+    void set_next_id(uint64_t id);
+    // Updates an entry's times; edges, if given to an entry without any,
+    // are rated like those passed to add().
+    void set_timing(size_t idx, uint32_t exec_us, uint32_t cpu_us,
+                    std::vector<uint32_t> edges = {});
+    // Null only while the corpus is empty. id, if given, receives the
+    // entry's id.
+    Input pick(uint64_t* id = nullptr);
     size_t size() const;
-    std::vector<std::vector<uint8_t>> get_all_items() const;
+    size_t favored() const;
+    std::vector<Input> get_all_items() const;
 
 private:
     struct Entry {
-        std::vector<uint8_t> data;
+        Input data;
+        uint64_t id = 0;
         uint32_t score = 1;
         uint64_t picks = 0;
+        uint32_t exec_us = 0;
+        uint32_t cpu_us = 0;
+        uint64_t weight = 0; // as currently stored in tree_
+        std::vector<uint32_t> edges;
+        uint64_t cost = 0;      // exec_us * size
+        uint32_t top_count = 0; // edges this entry is the cheapest for
+        bool favored = false;
     };
 
+    static constexpr uint32_t kNone = UINT32_MAX;     // edge never rated
+    static constexpr uint32_t kLost = UINT32_MAX - 1; // its entry was evicted
+    static constexpr uint64_t kDemote = 16;
+
+    // Selection weight: score decayed by how often the entry was picked,
+    // in 1/256 units, and divided by kDemote unless favored.
+    static uint64_t weight_of(const Entry& e);
+    void set_weight(size_t idx);
+    // Takes over every edge idx reaches cheaper than its current entry.
+    void rate(uint32_t idx);
+    // Recomputes the favored set from top_.
+    void cull();
+    // Drops the entry that is cheapest for the fewest edges; returns its id.
+    uint64_t evict();
+    // Stores e, rates it and makes room at the cap; under mu_. False if e
+    // itself was the entry dropped.
+    bool insert(Input item, Entry e);
+    // Fenwick tree over entry weights, 1-based; all under mu_.
+    void tree_push(uint64_t w);
+    void tree_add(size_t idx, int64_t delta);
+    // Index of the entry whose cumulative weight range contains cut.
+    [[nodiscard]] size_t tree_find(uint64_t cut) const;
+
     mutable std::mutex mu_;
     std::vector<Entry> items_;
+    std::vector<uint64_t> tree_;
+    uint64_t total_ = 0;
+    std::vector<uint32_t> top_;   // edge -> entry index, kNone or kLost
+    std::vector<uint32_t> rated_; // edges with a top_ slot, first-rated order
+    std::vector<uint8_t> covered_;
+    size_t favored_ = 0;
+    uint64_t next_id_ = 0;
+    bool dirty_ = false;
     size_t max_size_bytes_;
     size_t cap_;
 };
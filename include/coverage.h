@@ -1,12 +1,120 @@
 #ifndef FUZZ_COVERAGE_H
 #define FUZZ_COVERAGE_H
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
-constexpr size_t kCoverageSize = 1 << 17;
+// The edge map is a power of two in [kCovMinSize, kCovMaxSize]; the shm
+// always reserves the maximum and tmpfs only backs the pages touched. With
+// value profiling, kCovValueSize compare-distance features follow the edge
+// map directly and share its index space.
+constexpr size_t kCovMinSize = 1 << 12;
+constexpr size_t kCovMaxSize = 1 << 21;
+constexpr size_t kCovDefaultSize = 1 << 17;
+constexpr size_t kCovValueSize = 1 << 16;
 constexpr char kCoverageVar[] = "__FUZZ_SHARE";
+constexpr size_t kCovDirtyCap = 4096;
+constexpr size_t kCovHdrSize = 64 + 4 * kCovDirtyCap;
+
+// Precedes the edge map in the coverage shm; mirrors struct cov_header in
+// cov_runtime.c. The runtime lists each edge's first hit per run in dirty[]
+// and sets overflow once the list is full. guard_count, counters and
+// func_count come from the target; map_size and value_profile are read by
+// the target when it maps the shm.
+struct CovHeader {
+    uint32_t dirty_count;
+    uint32_t overflow;
+    uint32_t guard_count; // inline counters when counters is set
+    uint32_t map_size;
+    uint32_t value_profile;
+    uint32_t counters;
+    uint32_t func_count; // from the pc-table, if built with one
+    uint32_t reserved[9];
+    uint32_t dirty[kCovDirtyCap];
+};
+static_assert(sizeof(CovHeader) == kCovHdrSize);
+
+// Smallest map that keeps the estimated collision rate for this many
+// guards low, clamped to the supported range. Inline counters (direct)
+// index the map without hashing and only need one slot each.
+size_t pick_map_size(uint32_t guards, bool direct = false);
+// Expected share of edges that land on an already used slot, when edges
+// hash uniformly into size slots or, if direct, wrap around it.
+double collision_rate(uint32_t edges, size_t size, bool direct = false);
+
+// Bucket bits seen per edge by any worker. Words are claimed with a
+// relaxed fetch_or, so workers never take a lock to record coverage.
+// Sized for the largest map plus the value-profile region.
+//
+// Counters that vary between runs of one input are marked variable: all
+// their buckets count as seen, so they never report novelty again.
+class VirginMap {
+public:
+    static constexpr size_t kMaxVariable = 4096;
+
+    VirginMap();
+
+    [[nodiscard]] uint64_t load(const size_t w) const {
+        return words_[w].load(std::memory_order_relaxed);
+    }
+    uint64_t fetch_or(const size_t w, const uint64_t bits) {
+        return words_[w].fetch_or(bits, std::memory_order_relaxed);
+    }
+    // Indices in [begin, end) any worker has seen.
+    [[nodiscard]] size_t count(size_t begin, size_t end) const;
+
+    // False if idx was already variable.
+    bool mark_variable(size_t idx);
+    [[nodiscard]] bool is_variable(const size_t idx) const {
+        return var_bits_[idx / 64].load(std::memory_order_relaxed) >>
+            idx % 64 & 1;
+    }
+    [[nodiscard]] size_t variable_count() const {
+        return var_n_.load(std::memory_order_acquire);
+    }
+    // The i-th variable index; only the first kMaxVariable are listed.
+    // kNone while its writer has not stored it yet.
+    static constexpr uint32_t kNone = UINT32_MAX;
+    [[nodiscard]] uint32_t variable_at(const size_t i) const {
+        return var_list_[i].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    std::unique_ptr<std::atomic<uint64_t>[]> var_bits_;
+    std::unique_ptr<std::atomic<uint32_t>[]> var_list_;
+    std::atomic<size_t> var_n_{0};
+};
+
+// Hashes of the classified maps of past runs. Open addressing over
+// atomic slots, so lookups and inserts never lock. When the probe window
+// is full a hash is reported as new and the run is evaluated as usual.
+class PathSet {
+public:
+    PathSet();
+
+    // True unless h was inserted before.
+    bool insert(uint64_t h);
+    [[nodiscard]] size_t size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t kSlots = 1 << 20;
+    static constexpr size_t kMaxProbe = 32;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+    std::atomic<size_t> size_{0};
+};
+
+struct CovDelta {
+    size_t new_edges = 0;
+    size_t new_buckets = 0;
+    size_t new_values = 0; // value-profile features
+};
 
 class Coverage {
 public:
@@ -14,21 +122,56 @@ public:
     ~Coverage();
 
     bool setup();
+    // Clears only the edges the runtime listed unless its list overflowed.
     void reset() const;
-    [[nodiscard]] bool has_new_edge() const;
-    void merge();
-
-    size_t collect_new_edges(std::vector<uint32_t>* out_edges = nullptr) const;
+    // Buckets hit counts (1, 2, 3, 4-7, ... 128+) in place, once per run,
+    // and hashes the result.
+    void classify() const;
+    // Order-independent hash of this run's classified map, leaving out
+    // counters virgin marked variable; equal maps give equal hashes.
+    [[nodiscard]] uint64_t path_hash(const VirginMap& virgin) const;
+    // Appends idx << 8 | bucket for every counter this run hit, in
+    // ascending index order.
+    void entries(std::vector<uint32_t>& out) const;
+    // Publishes this run's buckets to virgin and reports what no worker
+    // had seen before; out receives the indices of those edges.
+    CovDelta claim(VirginMap& virgin, std::vector<uint32_t>* out = nullptr);
+    // Bucket bit of one edge for the current run.
+    [[nodiscard]] uint8_t bucket(uint32_t idx) const;
 
     [[nodiscard]] const std::string& shm_name() const {
         return shm_name_;
     }
+    // Guards or inline counters the last target run reported, or 0 for
+    // targets without either instrumentation.
+    [[nodiscard]] uint32_t guard_count() const;
+    // Whether the target uses inline-8bit-counters instead of guards.
+    [[nodiscard]] bool inline_counters() const;
+    [[nodiscard]] uint32_t func_count() const;
+
+    static const char* kernel_name();
+    // Map size for instances set up afterwards; set before any target
+    // maps their shm.
+    static void set_map_size(size_t size);
+    static size_t map_size();
+    static void set_value_profile(bool on);
+    static bool value_profile();
 
 private:
+    // Whether the dirty list covers every touched edge of this run.
+    [[nodiscard]] bool sparse() const;
+
+    using BlockMaskFn = void (*)(const uint8_t*, size_t, uint64_t*);
+
     int shm_id_ = -1;
+    CovHeader* hdr_ = nullptr;
     uint8_t* shm_map_ = nullptr;
-    std::vector<uint8_t> total_coverage_;
+    size_t size_ = kCovDefaultSize;
+    size_t span_ = kCovDefaultSize; // edges plus value-profile features
+    BlockMaskFn scan_ = nullptr;
     std::string shm_name_;
+    mutable bool classified_ = false;
+    mutable uint64_t path_hash_ = 0;
 };
 
 #endif //FUZZ_COVERAGE_H
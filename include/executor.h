@@ -1,14 +1,55 @@
 #ifndef FUZZ_EXECUTOR_H
 #define FUZZ_EXECUTOR_H
 
+#include <array>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <sys/types.h>
+
+struct epoll_event;
+class Coverage;
+
+constexpr char kForkSrvVar[] = "__FUZZ_FORKSRV";
+constexpr char kInputVar[] = "__FUZZ_INPUT";
+constexpr char kPersistVar[] = "__FUZZ_PERSIST";
+constexpr char kInputBackVar[] = "__FUZZ_INPUT_BACK";
+constexpr char kInputFilePath[] = "/dev/fd/197";
+constexpr int kInputBackStdin = 1;
+constexpr int kInputBackFile = 2;
+constexpr int kInputFileFd = 197;
+constexpr int kForkSrvFd = 198;
+constexpr uint32_t kForkSrvHello = 0x46535256;
+constexpr size_t kInputHdrSize = 64;
+
+enum class ExecMode {
+    Spawn,
+    ForkServer,
+    Persistent,
+};
+
+enum class Delivery {
+    File,
+    Shm,
+    Memfd,
+};
+
+enum class Capture {
+    // Nothing is read, so a sanitizer report on a zero exit (exitcode=0 in
+    // the sanitizer options) goes unseen and the run counts as clean.
+    // Signals and non-zero exits are still re-run with Full.
+    Discard,
+    Tail,
+    Full,
+};
 
 struct ExecResult {
     int exit_code = 0;
     int term_sig = 0;
     bool timed_out = false;
+    uint64_t wall_us = 0;
+    uint64_t cpu_us = 0; // spawn mode only
     std::string out;
     std::string err;
 };
@@ -17,18 +58,134 @@ struct ExecConfig {
     int timeout_ms = 1000;
     int mem_mb = 0;
     const char* cov_shm_name = nullptr;
+    // Owner of cov_shm_name, cleared before internal re-runs so the map
+    // shows only the run whose result is returned.
+    const Coverage* cov = nullptr;
+    const char* cmplog_shm_name = nullptr; // set only for cmp-log runs
+    ExecMode mode = ExecMode::Spawn;
+    int persist_iters = 0;
+    size_t input_cap = 0;
+    Delivery delivery = Delivery::File;
+    const char* exe_path = nullptr;
+    Capture capture = Capture::Full;
+    std::vector<int> allowed_exits;
+    int hang_ms = 0; // re-check timeouts at a longer limit, 0 = off
+};
+
+// Keeps the last kSize bytes written to it; never allocates.
+class TailBuffer {
+public:
+    static constexpr size_t kSize = 4096;
+
+    void clear() { len_ = 0; }
+    void append(const char* p, size_t n);
+    [[nodiscard]] std::string str() const;
+    // Searches in place, including across the wrap point.
+    [[nodiscard]] bool contains(std::string_view s) const;
+
+private:
+    std::array<char, kSize> buf_{};
+    size_t len_ = 0;
 };
 
 class Executor {
 public:
-    explicit Executor(const ExecConfig cfg) : cfg_(cfg) {}
+    explicit Executor(ExecConfig cfg);
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
 
     [[nodiscard]] ExecResult run(
         const std::vector<std::string>& argv_t,
-        const std::vector<uint8_t>& data) const;
+        const std::vector<uint8_t>& data);
+
+    // Non-blocking form of run(): start() launches, step() makes progress
+    // whenever poll_fd() is readable and returns true once finish() may be
+    // called. data must stay alive until finish() returns.
+    void start(const std::vector<std::string>& argv_t,
+               const std::vector<uint8_t>& data);
+    bool step(int wait_ms);
+    [[nodiscard]] ExecResult finish();
+    [[nodiscard]] bool done() const { return done_; }
+    [[nodiscard]] int poll_fd() const { return epfd_; }
+    [[nodiscard]] int wait_hint_ms() const;
+
+    void set_timeout_ms(const int ms) { cfg_.timeout_ms = ms; }
 
 private:
+    bool prepare(const std::vector<std::string>& argv_t);
+    [[nodiscard]] ExecResult rerun(int timeout_ms);
+    void begin_spawn();
+    void step_spawn(const epoll_event* evs, int n);
+    void end_spawn();
+    void cleanup_tmp();
+    void drop_fd(int& fd) const;
+    void begin_forksrv();
+    void step_forksrv(const epoll_event* evs, int n);
+    void fail_forksrv(const char* why);
+    bool start_forksrv();
+    void stop_forksrv();
+    bool setup_input_shm();
+    void release_input_shm();
+    void write_input_shm(const std::vector<uint8_t>& data);
+    bool drain(int fd, std::string& full, TailBuffer& tail) const;
+    void fill_output(ExecResult& R, std::string& outS, std::string& errS) const;
+    [[nodiscard]] bool wants_rerun(const ExecResult& R) const;
+    [[nodiscard]] int input_back_flags(
+        const std::vector<std::string>& argv_t) const;
+
     ExecConfig cfg_;
+    bool prepared_ = false;
+    bool need_file_ = false;
+    bool use_stdin_ = false;
+    std::string exe_;
+    std::vector<std::string> args_;
+    std::vector<char*> argv_;
+    std::vector<size_t> file_args_;
+    std::vector<std::string> env_;
+    std::vector<char*> envp_;
+    std::vector<char*> srv_envp_;
+    std::vector<char> child_stack_;
+    int devnull_fd_ = -1;
+    int epfd_ = -1;
+    int timer_fd_ = -1;
+
+    bool srv_failed_ = false;
+    pid_t srv_pid_ = -1;
+    int srv_ctl_fd_ = -1;
+    int srv_st_fd_ = -1;
+    int srv_out_fd_ = -1;
+    int srv_err_fd_ = -1;
+    int srv_in_fd_ = -1;
+    std::string srv_in_path_;
+    int in_shm_fd_ = -1;
+    uint8_t* in_shm_ = nullptr;
+    size_t in_shm_size_ = 0;
+    std::string in_shm_name_;
+    int memfd_ = -1;
+    TailBuffer out_tail_;
+    TailBuffer err_tail_;
+
+    const std::vector<uint8_t>* data_ = nullptr;
+    ExecResult res_;
+    bool done_ = true;
+    bool srv_run_ = false;
+    size_t got_ = 0;
+    struct {
+        pid_t pid;
+        int status;
+    } reply_{};
+    pid_t pid_ = -1;
+    int pidfd_ = -1;
+    int in_wr_ = -1;
+    int out_rd_ = -1;
+    int err_rd_ = -1;
+    size_t in_off_ = 0;
+    uint64_t t0_us_ = 0;
+    std::string tmp_path_;
+    std::string out_buf_;
+    std::string err_buf_;
 };
 
 #endif //FUZZ_EXECUTOR_H
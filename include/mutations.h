@@ -3,9 +3,12 @@
 
 #include <cstdint>
 #include <random>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "cmplog.h"
+
 struct Dict {
     std::vector<std::vector<uint8_t>> tokens;
 };
@@ -13,9 +16,16 @@ struct Dict {
 class Mutator {
 public:
     Mutator(uint64_t seed, size_t max_size, const Dict* dict = nullptr);
-    std::vector<uint8_t> mutate(const std::vector<uint8_t>& in);
-    std::vector<uint8_t> crossover(
-        const std::vector<uint8_t>& a, const std::vector<uint8_t>& b);
+    std::vector<uint8_t> mutate(std::span<const uint8_t> in);
+    std::vector<uint8_t> crossover(std::span<const uint8_t> a,
+                                   std::span<const uint8_t> b);
+    // Input-to-state stage: wherever one operand of a logged compare
+    // appears in in (host or swapped byte order), patch in the other
+    // operand and its +-1 neighbours. Appends at most limit candidates.
+    void input_to_state(std::span<const uint8_t> in,
+                        std::vector<CmpPair> pairs,
+                        std::vector<std::vector<uint8_t>>& out,
+                        size_t limit);
 
 private:
     std::mt19937_64 rng_;
@@ -23,11 +33,11 @@ private:
     const Dict* dict_;
 
     std::vector<uint8_t> rand_bytes(size_t n);
-    std::vector<uint8_t> flip_bits(const std::vector<uint8_t>& d);
-    std::vector<uint8_t> insert_bytes(const std::vector<uint8_t>& d);
-    std::vector<uint8_t> delete_bytes(const std::vector<uint8_t>& d);
-    std::vector<uint8_t> replace_bytes(const std::vector<uint8_t>& d);
-    std::vector<uint8_t> insert_dict(const std::vector<uint8_t>& d);
+    void flip_bits(std::vector<uint8_t>& d);
+    void insert_bytes(std::vector<uint8_t>& d);
+    void delete_bytes(std::vector<uint8_t>& d);
+    void replace_bytes(std::vector<uint8_t>& d);
+    void insert_dict(std::vector<uint8_t>& d);
 };
 
 bool load_dict(const std::string& path, Dict& d);
@@ -12,10 +12,20 @@ struct Options {
     std::unordered_set<int> allowed_exits;
     int iterations = 10000;
     int threads = 1;
-    int timeout_ms = 1000;
+    int timeout_ms = 0; // 0 = calibrate from the corpus
     int mem_mb = 0; // 0 = unlimited
     size_t max_size = 8192;
     uint64_t seed = 0; // 0 = random
+    bool fork_server = false;
+    int persistent = 0; // iterations per process, 0 = off
+    std::string input_mode = "file";
+    std::string capture = "tail";
+    int inflight = 1; // concurrent target runs per worker
+    bool bind = false;
+    std::string cpu_list; // explicit cores for --cpu
+    bool cmplog = false;
+    bool value_profile = false;
+    bool resume = false; // reload --out's queue and crash signatures
 };
 
 bool parse_options(int argc, char** argv, Options& o, std::string& err);
@@ -9,7 +9,9 @@ std::vector<std::string> split_cmdline(const std::string& s);
 std::string join_path(const std::string& a, const std::string& b);
 std::string now_iso8601();
 uint64_t now_mono_ms();
+uint64_t now_mono_us();
 int mktemp_file(std::string& path, const std::string& prefix);
+bool resolve_executable(const std::string& exe, std::string& full);
 uint64_t seed_from_os();
 
 #endif //FUZZ_UTILS_H
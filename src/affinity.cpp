@@ -0,0 +1,120 @@
+#include "affinity.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <set>
+#include <string>
+#include <unistd.h>
+
+// One CPU number: the whole token must be decimal digits, and the CPU must
+// fit in a cpu_set_t.
+static bool parse_cpu(const std::string& tok, int& cpu) {
+    if (tok.empty() || !std::isdigit(static_cast<unsigned char>(tok[0]))) {
+        return false;
+    }
+    size_t end = 0;
+    try {
+        cpu = std::stoi(tok, &end);
+    } catch (...) {
+        return false;
+    }
+    return end == tok.size() && cpu < CPU_SETSIZE;
+}
+
+bool parse_cpu_list(const std::string& s, std::vector<int>& out) {
+    out.clear();
+    size_t pos = 0;
+    while (pos < s.size()) {
+        const size_t c = s.find(',', pos);
+        const std::string tok = s.substr(pos, c == std::string::npos
+                                                  ? s.size() - pos
+                                                  : c - pos);
+        if (!tok.empty()) {
+            const size_t dash = tok.find('-');
+            int lo = 0;
+            int hi = 0;
+            if (!parse_cpu(tok.substr(0, dash), lo)) {
+                return false;
+            }
+            if (dash == std::string::npos) {
+                hi = lo;
+            } else if (!parse_cpu(tok.substr(dash + 1), hi) || hi < lo) {
+                return false;
+            }
+            for (int i = lo; i <= hi; ++i) {
+                out.push_back(i);
+            }
+        }
+        if (c == std::string::npos) {
+            break;
+        }
+        pos = c + 1;
+    }
+    std::ranges::sort(out);
+    const auto [first, last] = std::ranges::unique(out);
+    out.erase(first, last);
+    return !out.empty();
+}
+
+std::vector<int> free_cpus() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return {};
+    }
+
+    // A user task (kernel threads have no VmSize) whose affinity list is a
+    // single CPU is treated as owning it; that is how other instances bind.
+    // On a single-CPU box every list has one entry, so nothing is bound.
+    std::set<int> busy;
+    const bool smp = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    const std::string self = std::to_string(getpid());
+    std::error_code ec;
+    for (const auto& proc :
+         std::filesystem::directory_iterator("/proc", ec)) {
+        const std::string pid = proc.path().filename().string();
+        if (pid == self || !std::isdigit(static_cast<unsigned char>(pid[0]))) {
+            continue;
+        }
+        std::error_code tec;
+        for (const auto& task :
+             std::filesystem::directory_iterator(proc.path() / "task", tec)) {
+            std::ifstream f(task.path() / "status");
+            std::string line;
+            bool user = false;
+            while (std::getline(f, line)) {
+                if (line.starts_with("VmSize:")) {
+                    user = true;
+                }
+                if (!user || !line.starts_with("Cpus_allowed_list:")) {
+                    continue;
+                }
+                std::vector<int> cpus;
+                if (smp && parse_cpu_list(line.substr(line.find(':') + 1),
+                                          cpus) && cpus.size() == 1) {
+                    busy.insert(cpus[0]);
+                }
+                break;
+            }
+        }
+    }
+
+    std::vector<int> out;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &allowed) && !busy.contains(i)) {
+            out.push_back(i);
+        }
+    }
+    return out;
+}
+
+bool pin_thread(const int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
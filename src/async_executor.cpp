@@ -0,0 +1,155 @@
+#include "async_executor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <utility>
+#include <sys/epoll.h>
+
+#include "logger.h"
+
+AsyncExecutor::AsyncExecutor(const size_t inflight, const ExecConfig& cfg,
+                             std::vector<std::string> argv_t) :
+    inflight_(std::max<size_t>(inflight, 1)), cfg_(cfg),
+    argv_t_(std::move(argv_t)) {}
+
+AsyncExecutor::~AsyncExecutor() {
+    // Executors kill their in-flight children before the shm goes away.
+    for (auto& s : slots_) {
+        s->exec.reset();
+    }
+    if (epfd_ >= 0) {
+        close(epfd_);
+    }
+}
+
+bool AsyncExecutor::setup() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+        logx::warn("epoll_create1 failed");
+        return false;
+    }
+    for (size_t i = 0; i < inflight_; ++i) {
+        auto s = std::make_unique<Slot>();
+        if (!s->job.cov.setup()) {
+            return false;
+        }
+        ExecConfig cfg = cfg_;
+        cfg.cov_shm_name = s->job.cov.shm_name().c_str();
+        cfg.cov = &s->job.cov;
+        s->exec = std::make_unique<Executor>(std::move(cfg));
+        s->job.slot = i;
+        slots_.push_back(std::move(s));
+        idle_.push_back(inflight_ - 1 - i);
+    }
+    return true;
+}
+
+void AsyncExecutor::set_timeout_ms(const int ms) {
+    cfg_.timeout_ms = ms;
+    for (const auto& s : slots_) {
+        s->exec->set_timeout_ms(ms);
+    }
+}
+
+bool AsyncExecutor::submit(std::vector<uint8_t> input, const uint64_t tag,
+                           const uint64_t parent) {
+    if (idle_.empty()) {
+        return false;
+    }
+    const size_t idx = idle_.back();
+    idle_.pop_back();
+    Slot& s = *slots_[idx];
+    s.job.input = std::move(input);
+    s.job.tag = tag;
+    s.job.parent = parent;
+    s.job.result = {};
+    s.job.cov.reset();
+    s.state = State::Running;
+    ++running_;
+
+    s.exec->start(argv_t_, s.job.input);
+    if (!s.watched && s.exec->poll_fd() >= 0) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = idx;
+        s.watched = epoll_ctl(epfd_, EPOLL_CTL_ADD, s.exec->poll_fd(),
+                              &ev) == 0;
+    }
+    if (s.exec->done()) {
+        mark_ready(idx);
+    }
+    return true;
+}
+
+void AsyncExecutor::mark_ready(const size_t idx) {
+    if (slots_[idx]->state == State::Running) {
+        slots_[idx]->state = State::Ready;
+        ready_.push_back(idx);
+    }
+}
+
+AsyncExecutor::Job* AsyncExecutor::complete() {
+    while (ready_.empty()) {
+        if (running_ == 0) {
+            return nullptr;
+        }
+        int wait_ms = -1;
+        for (const auto& s : slots_) {
+            if (s->state == State::Running && s->exec->wait_hint_ms() >= 0) {
+                wait_ms = s->exec->wait_hint_ms();
+            }
+        }
+
+        epoll_event evs[16];
+        const int n = epoll_wait(epfd_, evs, 16, wait_ms);
+        if (n < 0 && errno != EINTR) {
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                if (slots_[i]->state == State::Running) {
+                    while (!slots_[i]->exec->step(-1)) {
+                    }
+                    mark_ready(i);
+                    break;
+                }
+            }
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            const auto idx = static_cast<size_t>(evs[i].data.u64);
+            if (slots_[idx]->state == State::Running &&
+                slots_[idx]->exec->step(0)) {
+                mark_ready(idx);
+            }
+        }
+        if (wait_ms >= 0) {
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                if (slots_[i]->state == State::Running &&
+                    slots_[i]->exec->wait_hint_ms() >= 0 &&
+                    slots_[i]->exec->step(0)) {
+                    mark_ready(i);
+                }
+            }
+        }
+    }
+
+    const size_t idx = ready_.back();
+    ready_.pop_back();
+    Slot& s = *slots_[idx];
+    s.job.result = s.exec->finish();
+    s.state = State::Held;
+    --running_;
+    return &s.job;
+}
+
+ExecResult AsyncExecutor::rerun(Job& job) {
+    Slot& s = *slots_[job.slot];
+    job.cov.reset();
+    return s.exec->run(argv_t_, job.input);
+}
+
+void AsyncExecutor::release(const Job* job) {
+    if (job && slots_[job->slot]->state == State::Held) {
+        slots_[job->slot]->state = State::Idle;
+        idle_.push_back(job->slot);
+    }
+}
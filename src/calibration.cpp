@@ -0,0 +1,79 @@
+#include "calibration.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include "logger.h"
+
+TimeoutTuner::TimeoutTuner(const int fixed_ms) :
+    ms_(fixed_ms > 0 ? fixed_ms : kDefaultMs), fixed_(fixed_ms > 0) {}
+
+void TimeoutTuner::add_sample(const uint64_t wall_us) {
+    if (fixed_) {
+        return;
+    }
+    std::lock_guard lk(mu_);
+    samples_.push_back(wall_us);
+    const size_t k = (samples_.size() - 1) * kPercentile / 100;
+    std::ranges::nth_element(samples_, samples_.begin() +
+                             static_cast<std::ptrdiff_t>(k));
+    const uint64_t ms = (samples_[k] * kMultiplier + 999) / 1000;
+    ms_.store(static_cast<int>(std::clamp<uint64_t>(ms, kMinMs,
+                                                    kCalibLimitMs)),
+              std::memory_order_relaxed);
+}
+
+void calibrate_corpus(Corpus& corpus, Executor& exec, const Coverage& cov,
+                      const std::vector<std::string>& argv_t,
+                      TimeoutTuner& tuner) {
+    exec.set_timeout_ms(kCalibLimitMs);
+    const auto items = corpus.get_all_items();
+    size_t slow = 0;
+    std::vector<uint32_t> stable, run, both;
+    for (size_t i = 0; i < items.size(); ++i) {
+        uint64_t wall = 0, cpu = 0;
+        int runs = 0;
+        for (; runs < kCalibRuns; ++runs) {
+            cov.reset();
+            const ExecResult R = exec.run(argv_t, *items[i]);
+            if (R.timed_out || R.exit_code < 0) {
+                break;
+            }
+            wall += R.wall_us;
+            cpu += R.cpu_us;
+            // Entries are idx << 8 | bucket, so a counter whose bucket
+            // changed between runs drops out here.
+            run.clear();
+            cov.entries(run);
+            if (runs == 0) {
+                stable.swap(run);
+                continue;
+            }
+            both.clear();
+            std::ranges::set_intersection(stable, run,
+                                          std::back_inserter(both));
+            stable.swap(both);
+        }
+        if (runs < kCalibRuns) {
+            slow++;
+            continue;
+        }
+        wall /= kCalibRuns;
+        cpu /= kCalibRuns;
+        std::vector<uint32_t> edges;
+        edges.reserve(stable.size());
+        for (const uint32_t e : stable) {
+            edges.push_back(e >> 8);
+        }
+        corpus.set_timing(i, static_cast<uint32_t>(wall),
+                          static_cast<uint32_t>(cpu), std::move(edges));
+        tuner.add_sample(wall);
+    }
+    if (slow > 0) {
+        logx::warn(std::to_string(slow) + " seed(s) timed out or failed at " +
+                   std::to_string(kCalibLimitMs) + " ms during calibration");
+    }
+    logx::info("timeout: " + std::to_string(tuner.timeout_ms()) + " ms" +
+               (tuner.fixed() ? " (fixed)" : " (calibrated)"));
+}
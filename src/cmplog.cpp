@@ -0,0 +1,74 @@
+#include "cmplog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "logger.h"
+
+namespace {
+constexpr size_t kCmpMapSize = kCmpSites * sizeof(CmpSite);
+} // namespace
+
+CmpLog::~CmpLog() {
+    if (sites_) {
+        munmap(sites_, kCmpMapSize);
+    }
+    if (shm_id_ >= 0) {
+        close(shm_id_);
+        shm_unlink(shm_name_.c_str());
+    }
+}
+
+bool CmpLog::setup() {
+    static std::atomic<uint32_t> g_cmp_cnt{0};
+    shm_name_ = "/fuzz_cmp_" + std::to_string(getpid()) + "_" +
+        std::to_string(++g_cmp_cnt);
+
+    shm_id_ = shm_open(shm_name_.c_str(), O_CREAT | O_RDWR, 0600);
+    if (shm_id_ < 0) {
+        logx::warn("cmplog shm_open failed");
+        return false;
+    }
+    if (ftruncate(shm_id_, kCmpMapSize) < 0) {
+        logx::warn("cmplog ftruncate failed");
+        return false;
+    }
+    void* map = mmap(nullptr, kCmpMapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     shm_id_, 0);
+    if (map == MAP_FAILED) {
+        logx::warn("cmplog mmap failed");
+        return false;
+    }
+    sites_ = static_cast<CmpSite*>(map);
+    return true;
+}
+
+void CmpLog::reset() {
+    if (!sites_) {
+        return;
+    }
+    for (size_t i = 0; i < kCmpSites; ++i) {
+        sites_[i].hits = 0;
+    }
+}
+
+std::vector<CmpPair> CmpLog::pairs() const {
+    std::vector<CmpPair> out;
+    if (!sites_) {
+        return out;
+    }
+    for (size_t i = 0; i < kCmpSites; ++i) {
+        const CmpSite& s = sites_[i];
+        const size_t n = std::min<size_t>(s.hits, kCmpDepth);
+        for (size_t k = 0; k < n; ++k) {
+            out.push_back({s.ops[k][0], s.ops[k][1], s.size});
+        }
+    }
+    std::ranges::sort(out);
+    const auto [first, last] = std::ranges::unique(out);
+    out.erase(first, last);
+    return out;
+}
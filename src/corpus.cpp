@@ -1,14 +1,148 @@
 #include "corpus.h"
 
+#include <algorithm>
+#include <bit>
 #include <filesystem>
 #include <fstream>
 #include <random>
 #include <thread>
+#include <tuple>
 
 #include "logger.h"
 
 Corpus::Corpus(const size_t max_size_bytes, const size_t max_items) :
-    max_size_bytes_(max_size_bytes), cap_(max_items) {}
+    max_size_bytes_(max_size_bytes), cap_(max_items) {
+    tree_.reserve(cap_ + 2);
+    tree_.push_back(0);
+}
+
+uint64_t Corpus::weight_of(const Entry& e) {
+    const uint64_t w =
+        std::max<uint64_t>(256, uint64_t{e.score} * 2048 / (8 + e.picks));
+    return e.favored ? w : w / kDemote;
+}
+
+void Corpus::set_weight(const size_t idx) {
+    Entry& e = items_[idx];
+    if (const uint64_t w = weight_of(e); w != e.weight) {
+        tree_add(idx, static_cast<int64_t>(w) - static_cast<int64_t>(e.weight));
+        e.weight = w;
+    }
+}
+
+void Corpus::rate(const uint32_t idx) {
+    Entry& e = items_[idx];
+    for (const uint32_t edge : e.edges) {
+        if (edge >= top_.size()) {
+            top_.resize(edge + 1, kNone);
+        }
+        uint32_t& t = top_[edge];
+        if (t == kNone) {
+            rated_.push_back(edge);
+        } else if (t != kLost) {
+            if (items_[t].cost <= e.cost) {
+                continue;
+            }
+            --items_[t].top_count;
+        }
+        t = idx;
+        ++e.top_count;
+        dirty_ = true;
+    }
+}
+
+void Corpus::cull() {
+    covered_.assign(top_.size(), 0);
+    for (Entry& e : items_) {
+        e.favored = false;
+    }
+    favored_ = 0;
+    for (const uint32_t edge : rated_) {
+        const uint32_t t = top_[edge];
+        if (t >= kLost || covered_[edge]) {
+            continue;
+        }
+        items_[t].favored = true;
+        ++favored_;
+        for (const uint32_t x : items_[t].edges) {
+            covered_[x] = 1;
+        }
+    }
+    for (size_t i = 0; i < items_.size(); ++i) {
+        set_weight(i);
+    }
+    dirty_ = false;
+}
+
+uint64_t Corpus::evict() {
+    const auto key = [](const Entry& e) {
+        return std::tuple(e.top_count, e.favored, e.score, ~e.picks);
+    };
+    size_t v = 0;
+    for (size_t i = 1; i < items_.size(); ++i) {
+        if (key(items_[i]) < key(items_[v])) {
+            v = i;
+        }
+    }
+    if (items_[v].top_count) {
+        for (const uint32_t edge : items_[v].edges) {
+            if (top_[edge] == v) {
+                top_[edge] = kLost;
+            }
+        }
+    }
+
+    const uint64_t id = items_[v].id;
+    // Move the last entry into the hole so indices stay dense.
+    const size_t last = items_.size() - 1;
+    const uint64_t w_last = items_[last].weight;
+    tree_add(v, -static_cast<int64_t>(items_[v].weight));
+    if (v != last) {
+        tree_add(v, static_cast<int64_t>(w_last));
+        for (const uint32_t edge : items_[last].edges) {
+            if (top_[edge] == last) {
+                top_[edge] = static_cast<uint32_t>(v);
+            }
+        }
+        items_[v] = std::move(items_[last]);
+        // The last node leaves the tree; its weight now counts at v.
+        total_ -= w_last;
+    }
+    tree_.pop_back();
+    items_.pop_back();
+    dirty_ = true;
+    return id;
+}
+
+void Corpus::tree_push(const uint64_t w) {
+    // The new node covers (i - lowbit(i), i]; the part before i is the
+    // sum of the child nodes already in the tree.
+    const size_t i = tree_.size();
+    uint64_t node = w;
+    for (size_t j = i - 1, stop = i - (i & -i); j > stop; j -= j & -j) {
+        node += tree_[j];
+    }
+    tree_.push_back(node);
+    total_ += w;
+}
+
+void Corpus::tree_add(const size_t idx, const int64_t delta) {
+    for (size_t i = idx + 1; i < tree_.size(); i += i & -i) {
+        tree_[i] += static_cast<uint64_t>(delta);
+    }
+    total_ += static_cast<uint64_t>(delta);
+}
+
+size_t Corpus::tree_find(uint64_t cut) const {
+    size_t pos = 0;
+    for (size_t step = std::bit_floor(tree_.size() - 1); step; step >>= 1) {
+        if (pos + step < tree_.size() && tree_[pos + step] <= cut) {
+            pos += step;
+            cut -= tree_[pos];
+        }
+    }
+    return pos;
+}
 
 bool Corpus::load_dir(const std::string& dir) {
     size_t n = 0, skipped = 0;
@@ -27,41 +161,89 @@ bool Corpus::load_dir(const std::string& dir) {
             skipped++;
             continue;
         }
-        if (b.size() > max_size_bytes_) {
-            b.resize(max_size_bytes_);
-        }
-        add(b, 1);
+        add(make_input(std::move(b)), 1);
         n++;
     }
     logx::info("loaded seeds: " + std::to_string(n) + " skipped: " +
                std::to_string(skipped));
     if (size() == 0) {
-        std::vector<uint8_t> def = {'s', 'e', 'e', 'd'};
-        add(def, 1);
+        add(make_input({'s', 'e', 'e', 'd'}), 1);
     }
     return size() > 0;
 }
 
-void Corpus::add(const std::vector<uint8_t>& item, uint32_t score) {
+std::optional<uint64_t> Corpus::add(Input item, uint32_t score,
+                                    const uint32_t exec_us,
+                                    const uint32_t cpu_us,
+                                    std::vector<uint32_t> edges) {
     std::lock_guard lk(mu_);
-    if (items_.size() >= cap_) {
-        return;
+    const uint64_t id = next_id_++;
+    Entry e;
+    e.id = id;
+    e.score = score == 0 ? 1u : score;
+    e.exec_us = exec_us;
+    e.cpu_us = cpu_us;
+    e.edges = std::move(edges);
+    if (!insert(std::move(item), std::move(e))) {
+        return std::nullopt;
     }
+    return id;
+}
 
+void Corpus::restore(const uint64_t id, Input item, const uint32_t score,
+                     const uint32_t exec_us, std::vector<uint32_t> edges) {
+    std::lock_guard lk(mu_);
     Entry e;
-    e.data = item;
-    if (e.data.size() > max_size_bytes_) {
-        e.data.resize(max_size_bytes_);
-    }
+    e.id = id;
+    next_id_ = std::max(next_id_, id + 1);
     e.score = score == 0 ? 1u : score;
-    e.picks = 0;
+    e.exec_us = exec_us;
+    e.edges = std::move(edges);
+    insert(std::move(item), std::move(e));
+}
+
+bool Corpus::insert(Input item, Entry e) {
+    if (item->size() > max_size_bytes_) {
+        item = make_input({item->begin(), item->begin() +
+                           static_cast<std::ptrdiff_t>(max_size_bytes_)});
+    }
+    e.data = std::move(item);
+    e.cost = uint64_t{std::max(e.exec_us, 1u)} * e.data->size();
+    e.weight = weight_of(e);
+    tree_push(e.weight);
+    const uint64_t id = e.id;
     items_.push_back(std::move(e));
+    rate(static_cast<uint32_t>(items_.size() - 1));
+    return items_.size() <= cap_ || evict() != id;
+}
+
+void Corpus::set_next_id(const uint64_t id) {
+    std::lock_guard lk(mu_);
+    next_id_ = std::max(next_id_, id);
+}
+
+void Corpus::set_timing(const size_t idx, const uint32_t exec_us,
+                        const uint32_t cpu_us, std::vector<uint32_t> edges) {
+    std::lock_guard lk(mu_);
+    if (idx >= items_.size()) {
+        return;
+    }
+    Entry& e = items_[idx];
+    e.exec_us = exec_us;
+    e.cpu_us = cpu_us;
+    if (!e.edges.empty() || edges.empty()) {
+        return;
+    }
+    // Unrated so far, so no top_ slot holds the old cost.
+    e.cost = uint64_t{std::max(exec_us, 1u)} * e.data->size();
+    e.edges = std::move(edges);
+    rate(static_cast<uint32_t>(idx));
 }
 
-std::vector<uint8_t> Corpus::pick() {
+Input Corpus::pick(uint64_t* id) {
     std::lock_guard lk(mu_);
     if (items_.empty()) {
-        return {};
+        return nullptr;
     }
 
     thread_local std::mt19937_64 rng{
@@ -69,32 +251,17 @@ std::vector<uint8_t> Corpus::pick() {
             {}(std::this_thread::get_id()))
     };
 
-    long double total_w = 0.0L;
-    std::vector<long double> weights;
-    weights.reserve(items_.size());
-    for (const auto& e : items_) {
-        const long double decay = 1.0L + static_cast<long double>(e.picks) /
-            8.0L;
-        long double w = static_cast<long double>(e.score) / decay;
-        if (w < 1.0L) {
-            w = 1.0L;
-        }
-        weights.push_back(w);
-        total_w += w;
+    if (dirty_) {
+        cull();
     }
-
-    std::uniform_real_distribution dist(0.0L, total_w);
-    long double cut = dist(rng);
-
-    for (size_t i = 0; i < items_.size(); ++i) {
-        if (cut <= weights[i]) {
-            items_[i].picks++;
-            return items_[i].data;
-        }
-        cut -= weights[i];
+    std::uniform_int_distribution<uint64_t> dist(0, total_ - 1);
+    const size_t idx = tree_find(dist(rng));
+    items_[idx].picks++;
+    set_weight(idx);
+    if (id) {
+        *id = items_[idx].id;
     }
-    items_.back().picks++;
-    return items_.back().data;
+    return items_[idx].data;
 }
 
 size_t Corpus::size() const {
@@ -102,9 +269,14 @@ size_t Corpus::size() const {
     return items_.size();
 }
 
-std::vector<std::vector<uint8_t>> Corpus::get_all_items() const {
+size_t Corpus::favored() const {
+    std::lock_guard lk(mu_);
+    return favored_;
+}
+
+std::vector<Input> Corpus::get_all_items() const {
     std::lock_guard lk(mu_);
-    std::vector<std::vector<uint8_t>> all_data;
+    std::vector<Input> all_data;
     all_data.reserve(items_.size());
     for (const auto& entry : items_) {
         all_data.push_back(entry.data);
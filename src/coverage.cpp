@@ -1,20 +1,275 @@
 #include "coverage.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <string>
 #include <unistd.h>
 #include <sys/mman.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "logger.h"
 
-Coverage::Coverage() : total_coverage_(kCoverageSize, 0) {}
+namespace {
+constexpr uint64_t kLow7 = 0x7f7f7f7f7f7f7f7fULL;
+constexpr uint64_t kHigh = 0x8080808080808080ULL;
+
+// Hit count -> bucket bit: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+.
+constexpr std::array<uint8_t, 256> kBucket8 = [] {
+    std::array<uint8_t, 256> t{};
+    for (int i = 1; i < 256; ++i) {
+        t[i] = i == 1 ? 1 : i == 2 ? 2 : i == 3 ? 4 : i < 8 ? 8 : i < 16
+                   ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+    }
+    return t;
+}();
+
+// Two counters per lookup, as in AFL's classify_counts.
+const std::array<uint16_t, 65536> kBucket16 = [] {
+    std::array<uint16_t, 65536> t{};
+    for (size_t i = 0; i < t.size(); ++i) {
+        t[i] = static_cast<uint16_t>(kBucket8[i & 0xFF] |
+                                     kBucket8[i >> 8] << 8);
+    }
+    return t;
+}();
+
+// High bit of every non-zero byte of w.
+uint64_t nonzero_bytes(const uint64_t w) {
+    return (w | ((w & kLow7) + kLow7)) & kHigh;
+}
+
+uint64_t classify_word(const uint64_t w) {
+    uint16_t h[4];
+    std::memcpy(h, &w, sizeof(h));
+    for (uint16_t& x : h) {
+        x = kBucket16[x];
+    }
+    uint64_t out;
+    std::memcpy(&out, h, sizeof(out));
+    return out;
+}
+
+// Path hash term for one classified counter. Terms are summed, so the
+// hash does not depend on the order counters are visited in.
+uint64_t path_term(const size_t idx, const uint8_t bucket) {
+    uint64_t x = (static_cast<uint64_t>(idx) << 8 | bucket) +
+        0x9e3779b97f4a7c15ULL;
+    x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ x >> 27) * 0x94d049bb133111ebULL;
+    return x ^ x >> 31;
+}
+
+void classify_block(uint8_t* p) {
+    for (size_t k = 0; k < 64; k += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + k, 8);
+        if (w) {
+            w = classify_word(w);
+            std::memcpy(p + k, &w, 8);
+        }
+    }
+}
+
+// Target guards per map slot; keeps the collision estimate near 3%.
+constexpr size_t kSlotsPerGuard = 32;
+
+size_t g_map_size = kCovDefaultSize;
+bool g_value_profile = false;
+
+constexpr size_t kCovShmSize = kCovHdrSize + kCovMaxSize + kCovValueSize;
+
+// Sets bit b of mask for every non-zero 64-byte block b of map. n must be
+// a multiple of 4096. Kernels are instantiated with N fixed for the common
+// map sizes so the outer loop has a constant trip count; N = 0 reads n.
+using BlockMaskFn = void (*)(const uint8_t* map, size_t n, uint64_t* mask);
+
+constexpr std::array<size_t, 3> kFixedSizes = {1 << 16, 1 << 17, 1 << 18};
+
+template <size_t N>
+[[maybe_unused]]
+void blocks_word(const uint8_t* map, const size_t n, uint64_t* mask) {
+    for (size_t i = 0; i < (N ? N : n) / 4096; ++i) {
+        uint64_t m = 0;
+        for (size_t b = 0; b < 64; ++b) {
+            uint64_t w[8];
+            std::memcpy(w, map + (i * 64 + b) * 64, sizeof(w));
+            const uint64_t any = w[0] | w[1] | w[2] | w[3] | w[4] | w[5] |
+                w[6] | w[7];
+            m |= static_cast<uint64_t>(any != 0) << b;
+        }
+        mask[i] = m;
+    }
+}
+
+#if defined(__x86_64__)
+template <size_t N>
+void blocks_sse2(const uint8_t* map, const size_t n, uint64_t* mask) {
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < (N ? N : n) / 4096; ++i) {
+        uint64_t m = 0;
+        for (size_t b = 0; b < 64; ++b) {
+            const auto* p = reinterpret_cast<const __m128i*>(
+                map + (i * 64 + b) * 64);
+            const __m128i any = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+            m |= static_cast<uint64_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) << b;
+        }
+        mask[i] = m;
+    }
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+void blocks_avx2(const uint8_t* map, const size_t n, uint64_t* mask) {
+    for (size_t i = 0; i < (N ? N : n) / 4096; ++i) {
+        uint64_t m = 0;
+        for (size_t b = 0; b < 64; ++b) {
+            const auto* p = reinterpret_cast<const __m256i*>(
+                map + (i * 64 + b) * 64);
+            const __m256i any = _mm256_or_si256(_mm256_loadu_si256(p),
+                                                _mm256_loadu_si256(p + 1));
+            m |= static_cast<uint64_t>(!_mm256_testz_si256(any, any)) << b;
+        }
+        mask[i] = m;
+    }
+}
+#endif
+
+struct ScanKernel {
+    std::array<BlockMaskFn, kFixedSizes.size()> fixed;
+    BlockMaskFn any;
+    const char* name;
+
+    [[nodiscard]] BlockMaskFn for_size(const size_t n) const {
+        for (size_t i = 0; i < kFixedSizes.size(); ++i) {
+            if (kFixedSizes[i] == n) {
+                return fixed[i];
+            }
+        }
+        return any;
+    }
+};
+
+ScanKernel pick_scan() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {{blocks_avx2<kFixedSizes[0]>, blocks_avx2<kFixedSizes[1]>,
+                 blocks_avx2<kFixedSizes[2]>}, blocks_avx2<0>, "avx2"};
+    }
+    return {{blocks_sse2<kFixedSizes[0]>, blocks_sse2<kFixedSizes[1]>,
+             blocks_sse2<kFixedSizes[2]>}, blocks_sse2<0>, "sse2"};
+#else
+    return {{blocks_word<kFixedSizes[0]>, blocks_word<kFixedSizes[1]>,
+             blocks_word<kFixedSizes[2]>}, blocks_word<0>, "word"};
+#endif
+}
+
+const ScanKernel g_scan = pick_scan();
+
+// Calls f(block) for every non-zero 64-byte block of an n-byte map.
+template <typename F>
+void for_each_block(const uint8_t* map, const size_t n,
+                    const BlockMaskFn scan, F&& f) {
+    uint64_t mask[(kCovMaxSize + kCovValueSize) / 4096];
+    scan(map, n, mask);
+    for (size_t i = 0; i < n / 4096; ++i) {
+        for (uint64_t m = mask[i]; m; m &= m - 1) {
+            f(i * 64 + static_cast<size_t>(std::countr_zero(m)));
+        }
+    }
+}
+static_assert(kCovMinSize % 4096 == 0);
+} // namespace
+
+size_t pick_map_size(const uint32_t guards, const bool direct) {
+    if (guards == 0) {
+        return kCovDefaultSize;
+    }
+    return std::clamp(std::bit_ceil(guards * (direct ? 1 : kSlotsPerGuard)),
+                      kCovMinSize, kCovMaxSize);
+}
+
+double collision_rate(const uint32_t edges, const size_t size,
+                      const bool direct) {
+    if (direct) {
+        return edges > size ? 1 - static_cast<double>(size) / edges : 0;
+    }
+    if (edges < 2) {
+        return 0;
+    }
+    return 1 - std::exp(-static_cast<double>(edges - 1) /
+                        static_cast<double>(size));
+}
+
+VirginMap::VirginMap() :
+    words_(std::make_unique<std::atomic<uint64_t>[]>(
+        (kCovMaxSize + kCovValueSize) / 8)),
+    var_bits_(std::make_unique<std::atomic<uint64_t>[]>(
+        (kCovMaxSize + kCovValueSize) / 64)),
+    var_list_(std::make_unique<std::atomic<uint32_t>[]>(kMaxVariable)) {
+    for (size_t i = 0; i < kMaxVariable; ++i) {
+        var_list_[i].store(kNone, std::memory_order_relaxed);
+    }
+}
+
+bool VirginMap::mark_variable(const size_t idx) {
+    const uint64_t bit = 1ULL << idx % 64;
+    if (var_bits_[idx / 64].fetch_or(bit, std::memory_order_relaxed) & bit) {
+        return false;
+    }
+    fetch_or(idx / 8, 0xFFULL << idx % 8 * 8);
+    const size_t n = var_n_.fetch_add(1, std::memory_order_acq_rel);
+    if (n < kMaxVariable) {
+        var_list_[n].store(static_cast<uint32_t>(idx),
+                           std::memory_order_relaxed);
+    }
+    return true;
+}
+
+size_t VirginMap::count(const size_t begin, const size_t end) const {
+    size_t n = 0;
+    for (size_t w = begin / 8; w < end / 8; ++w) {
+        n += static_cast<size_t>(std::popcount(nonzero_bytes(load(w))));
+    }
+    return n;
+}
+
+PathSet::PathSet() : slots_(std::make_unique<std::atomic<uint64_t>[]>(
+    kSlots)) {}
+
+bool PathSet::insert(uint64_t h) {
+    h = h ? h : 1;
+    for (size_t i = 0; i < kMaxProbe; ++i) {
+        std::atomic<uint64_t>& s = slots_[(h + i) & (kSlots - 1)];
+        uint64_t cur = s.load(std::memory_order_relaxed);
+        if (cur == 0 && s.compare_exchange_strong(
+                cur, h, std::memory_order_relaxed)) {
+            size_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (cur == h) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Coverage::Coverage() = default;
 
 Coverage::~Coverage() {
-    if (shm_map_) {
-        munmap(shm_map_, kCoverageSize);
+    if (hdr_) {
+        munmap(hdr_, kCovShmSize);
     }
     if (shm_id_ >= 0) {
         close(shm_id_);
@@ -37,68 +292,226 @@ bool Coverage::setup() {
         return false;
     }
 
-    if (ftruncate(shm_id_, kCoverageSize) < 0) {
+    if (ftruncate(shm_id_, kCovShmSize) < 0) {
         logx::warn("ftruncate failed");
         close(shm_id_);
         shm_unlink(shm_name_.c_str());
         return false;
     }
 
-    shm_map_ = static_cast<uint8_t*>(mmap(nullptr, kCoverageSize,
-                                          PROT_READ | PROT_WRITE, MAP_SHARED,
-                                          shm_id_, 0));
+    void* map = mmap(nullptr, kCovShmSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     shm_id_, 0);
 
-    if (shm_map_ == MAP_FAILED) {
+    if (map == MAP_FAILED) {
         logx::warn("mmap failed");
         close(shm_id_);
         shm_unlink(shm_name_.c_str());
         return false;
     }
+    hdr_ = static_cast<CovHeader*>(map);
+    shm_map_ = static_cast<uint8_t*>(map) + kCovHdrSize;
+    size_ = g_map_size;
+    span_ = size_ + (g_value_profile ? kCovValueSize : 0);
+    scan_ = g_scan.for_size(span_);
+    hdr_->map_size = static_cast<uint32_t>(size_);
+    hdr_->value_profile = g_value_profile;
 
     return true;
 }
 
+uint32_t Coverage::guard_count() const {
+    return hdr_ ? hdr_->guard_count : 0;
+}
+
+bool Coverage::inline_counters() const {
+    return hdr_ && hdr_->counters;
+}
+
+uint32_t Coverage::func_count() const {
+    return hdr_ ? hdr_->func_count : 0;
+}
+
+bool Coverage::sparse() const {
+    return !hdr_->overflow && hdr_->dirty_count <= kCovDirtyCap;
+}
+
 void Coverage::reset() const {
-    if (shm_map_) {
-        std::memset(shm_map_, 0, kCoverageSize);
+    classified_ = false;
+    if (!shm_map_) {
+        return;
     }
+    if (sparse()) {
+        for (uint32_t i = 0; i < hdr_->dirty_count; ++i) {
+            if (hdr_->dirty[i] < span_) {
+                shm_map_[hdr_->dirty[i]] = 0;
+            }
+        }
+    } else {
+        std::memset(shm_map_, 0, span_);
+    }
+    hdr_->dirty_count = 0;
+    hdr_->overflow = 0;
 }
 
-bool Coverage::has_new_edge() const {
-    if (!shm_map_) {
-        return false;
+void Coverage::classify() const {
+    if (!shm_map_ || classified_) {
+        return;
     }
-    for (size_t i = 0; i < kCoverageSize; ++i) {
-        if (shm_map_[i] && !total_coverage_[i]) {
-            return true;
+    uint64_t h = 0;
+    if (sparse()) {
+        for (uint32_t i = 0; i < hdr_->dirty_count; ++i) {
+            const size_t idx = hdr_->dirty[i];
+            if (idx < span_) {
+                uint8_t& c = shm_map_[idx];
+                c = kBucket8[c];
+                h += path_term(idx, c);
+            }
         }
+    } else {
+        for_each_block(shm_map_, span_, scan_, [&](const size_t b) {
+            uint8_t* p = shm_map_ + b * 64;
+            classify_block(p);
+            for (size_t k = 0; k < 64; k += 8) {
+                uint64_t w;
+                std::memcpy(&w, p + k, 8);
+                for (uint64_t m = nonzero_bytes(w); m; m &= m - 1) {
+                    const size_t j = k + static_cast<size_t>(
+                        std::countr_zero(m)) / 8;
+                    h += path_term(b * 64 + j, p[j]);
+                }
+            }
+        });
     }
-    return false;
+    path_hash_ = h;
+    classified_ = true;
 }
 
-void Coverage::merge() {
+uint64_t Coverage::path_hash(const VirginMap& virgin) const {
+    classify();
+    uint64_t h = path_hash_;
+    const size_t n = std::min(virgin.variable_count(),
+                              VirginMap::kMaxVariable);
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t idx = virgin.variable_at(i);
+        if (idx < span_ && shm_map_[idx]) {
+            h -= path_term(idx, shm_map_[idx]);
+        }
+    }
+    return h;
+}
+
+void Coverage::entries(std::vector<uint32_t>& out) const {
     if (!shm_map_) {
         return;
     }
-    for (size_t i = 0; i < kCoverageSize; ++i) {
-        if (shm_map_[i]) {
-            total_coverage_[i] = 1;
+    classify();
+    const size_t first = out.size();
+    if (sparse()) {
+        for (uint32_t i = 0; i < hdr_->dirty_count; ++i) {
+            const size_t idx = hdr_->dirty[i];
+            if (idx < span_ && shm_map_[idx]) {
+                out.push_back(static_cast<uint32_t>(idx << 8 |
+                                                    shm_map_[idx]));
+            }
         }
+        std::sort(out.begin() + static_cast<std::ptrdiff_t>(first),
+                  out.end());
+        return;
     }
+    for_each_block(shm_map_, span_, scan_, [&](const size_t b) {
+        for (size_t j = b * 64; j < b * 64 + 64; ++j) {
+            if (shm_map_[j]) {
+                out.push_back(static_cast<uint32_t>(j << 8 | shm_map_[j]));
+            }
+        }
+    });
 }
 
-size_t Coverage::collect_new_edges(std::vector<uint32_t>* out_edges) const {
+CovDelta Coverage::claim(VirginMap& virgin, std::vector<uint32_t>* out) {
+    CovDelta d;
     if (!shm_map_) {
-        return 0;
+        return d;
+    }
+    classify();
+    if (sparse()) {
+        for (uint32_t i = 0; i < hdr_->dirty_count; ++i) {
+            const size_t idx = hdr_->dirty[i];
+            if (idx >= span_) {
+                continue;
+            }
+            const uint8_t c = shm_map_[idx];
+            const size_t w = idx / 8, shift = idx % 8 * 8;
+            const uint64_t bits = static_cast<uint64_t>(c) << shift;
+            if (!(bits & ~virgin.load(w))) {
+                continue;
+            }
+            const auto seen = static_cast<uint8_t>(
+                virgin.fetch_or(w, bits) >> shift);
+            if (!(c & ~seen)) {
+                continue;
+            }
+            ++(idx >= size_ ? d.new_values
+               : seen ? d.new_buckets : d.new_edges);
+            if (out) {
+                out->push_back(static_cast<uint32_t>(idx));
+            }
+        }
+        return d;
     }
-    size_t cnt = 0;
-    for (size_t i = 0; i < kCoverageSize; ++i) {
-        if (shm_map_[i] && !total_coverage_[i]) {
-            ++cnt;
-            if (out_edges) {
-                out_edges->push_back(static_cast<uint32_t>(i));
+    for_each_block(shm_map_, span_, scan_, [&](const size_t b) {
+        uint8_t* p = shm_map_ + b * 64;
+        const bool value = b * 64 >= size_;
+        for (size_t k = 0; k < 8; ++k) {
+            uint64_t m;
+            std::memcpy(&m, p + k * 8, 8);
+            const size_t w = b * 8 + k;
+            if (!(m & ~virgin.load(w))) {
+                continue;
+            }
+            const uint64_t old = virgin.fetch_or(w, m);
+            uint64_t fresh = nonzero_bytes(m & ~old);
+            const uint64_t seen = nonzero_bytes(old);
+            if (value) {
+                d.new_values += static_cast<size_t>(std::popcount(fresh));
+            } else {
+                d.new_edges += static_cast<size_t>(
+                    std::popcount(fresh & ~seen));
+                d.new_buckets += static_cast<size_t>(
+                    std::popcount(fresh & seen));
+            }
+            for (; out && fresh; fresh &= fresh - 1) {
+                out->push_back(static_cast<uint32_t>(
+                    w * 8 + static_cast<size_t>(std::countr_zero(fresh)) / 8));
             }
         }
+    });
+    return d;
+}
+
+uint8_t Coverage::bucket(const uint32_t idx) const {
+    if (!shm_map_ || idx >= span_) {
+        return 0;
     }
-    return cnt;
+    classify();
+    return shm_map_[idx];
+}
+
+const char* Coverage::kernel_name() {
+    return g_scan.name;
+}
+
+void Coverage::set_map_size(const size_t size) {
+    g_map_size = size;
+}
+
+size_t Coverage::map_size() {
+    return g_map_size;
+}
+
+void Coverage::set_value_profile(const bool on) {
+    g_value_profile = on;
+}
+
+bool Coverage::value_profile() {
+    return g_value_profile;
 }
@@ -100,14 +100,20 @@ CrashInfo analyze_and_sig(
     int exit_code, int term_sig, bool timed_out, const std::string& out,
     const std::string& err, const std::vector<int>& allowed_exits) {
     CrashInfo ci;
-    const std::string comb = out + "\n" + err;
-
     if (timed_out) {
         ci.crashed = true;
         ci.reason = "timeout";
         ci.signature = "timeout";
         return ci;
     }
+    // A clean exit is only a crash if a sanitizer reported anyway.
+    if (term_sig == 0 && exit_code == 0 &&
+        err.find("AddressSanitizer") == std::string::npos &&
+        out.find("AddressSanitizer") == std::string::npos) {
+        return ci;
+    }
+
+    const std::string comb = out + "\n" + err;
 
     const std::string asan_err = first_line(comb, "ERROR: AddressSanitizer:");
     const std::string asan_deadly =
@@ -1,23 +1,41 @@
 #include "executor.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
 #include <poll.h>
+#include <sched.h>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <vector>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 
+#include "cmplog.h"
 #include "coverage.h"
 #include "logger.h"
 #include "utils.h"
 
 namespace {
+enum : uint32_t {
+    kEvOut,
+    kEvErr,
+    kEvIn,
+    kEvChild,
+    kEvStatus,
+    kEvTimer,
+};
+
 int set_nonblock(const int fd) {
     const int f = fcntl(fd, F_GETFL, 0);
     return fcntl(fd, F_SETFL, f | O_NONBLOCK);
@@ -42,16 +60,11 @@ void ignore_sigpipe() {
     sa.sa_flags = 0;
     sigaction(SIGPIPE, &sa, nullptr);
 }
-} // namespace
-
-ExecResult Executor::run(
-    const std::vector<std::string>& argv_t,
-    const std::vector<uint8_t>& data) const {
-    ExecResult R;
 
-    ignore_sigpipe();
-
-    bool need_file = false, use_stdin = false;
+void scan_argv(const std::vector<std::string>& argv_t, bool& need_file,
+               bool& use_stdin) {
+    need_file = false;
+    use_stdin = false;
     for (const auto& t : argv_t) {
         if (t == "@@") {
             need_file = true;
@@ -64,261 +77,994 @@ ExecResult Executor::run(
     if (!need_file && !use_stdin) {
         use_stdin = true;
     }
+}
+
+template <typename Sink>
+bool drain_fd(const int fd, Sink&& sink) {
+    char buf[8192];
+    while (true) {
+        const ssize_t r = read(fd, buf, sizeof(buf));
+        if (r > 0) {
+            sink(buf, static_cast<size_t>(r));
+            continue;
+        }
+        return r == 0;
+    }
+}
+
+bool is_clean(const ExecResult& R) {
+    return !R.timed_out && R.term_sig == 0 && R.exit_code == 0;
+}
+
+// Sanitizers can report and still exit 0 (exitcode=0, halt_on_error=0).
+bool has_report(const ExecResult& R) {
+    return R.err.find("Sanitizer") != std::string::npos ||
+        R.out.find("Sanitizer") != std::string::npos;
+}
 
-    std::vector<std::string> args;
-    args.reserve(argv_t.size() + 1);
+bool ep_add(const int epfd, const int fd, const uint32_t events,
+            const uint32_t tag) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u32 = tag;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
 
-    std::string tmpPath;
-    int tmpFd = -1;
+void arm_timer(const int tfd, const int ms) {
+    itimerspec its{};
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+    timerfd_settime(tfd, 0, &its, nullptr);
+}
+
+void close_fd(int& fd) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void dup_to(const int fd, const int target) {
+    if (fd == target) {
+        fcntl(fd, F_SETFD, 0);
+    } else {
+        dup2(fd, target);
+    }
+}
 
-    auto cleanup_tmp = [&] {
-        if (tmpFd >= 0) {
-            close(tmpFd);
-            tmpFd = -1;
+bool write_all_at(const int fd, const std::vector<uint8_t>& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        const ssize_t w = pwrite(fd, data.data() + off, data.size() - off,
+                                 static_cast<off_t>(off));
+        if (w <= 0) {
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
         }
-        if (!tmpPath.empty()) {
-            unlink(tmpPath.c_str());
-            tmpPath.clear();
+        off += static_cast<size_t>(w);
+    }
+    return true;
+}
+
+bool rewrite_input_fd(const int fd, const std::vector<uint8_t>& data) {
+    if (ftruncate(fd, 0) < 0 || !write_all_at(fd, data)) {
+        return false;
+    }
+    return lseek(fd, 0, SEEK_SET) == 0;
+}
+
+struct ChildSpec {
+    const char* path = nullptr;
+    char* const* argv = nullptr;
+    char* const* envp = nullptr;
+    int in_fd = -1;
+    int out_fd = -1;
+    int err_fd = -1;
+    int file_fd = -1;
+    int ctl_fd = -1;
+    int st_fd = -1;
+    int mem_mb = 0;
+};
+
+// Runs on the parent's memory until execve: plain syscalls only, no malloc.
+int child_main(void* arg) {
+    const auto* c = static_cast<const ChildSpec*>(arg);
+    setsid();
+
+    int ctl = -1, st = -1;
+    if (c->ctl_fd >= 0) {
+        ctl = fcntl(c->ctl_fd, F_DUPFD, kForkSrvFd + 2);
+        st = fcntl(c->st_fd, F_DUPFD, kForkSrvFd + 2);
+    }
+    dup_to(c->in_fd, STDIN_FILENO);
+    dup_to(c->out_fd, STDOUT_FILENO);
+    dup_to(c->err_fd, STDERR_FILENO);
+    if (c->file_fd >= 0) {
+        dup_to(c->file_fd, kInputFileFd);
+    }
+    if (ctl >= 0) {
+        dup2(ctl, kForkSrvFd);
+        dup2(st, kForkSrvFd + 1);
+        close(ctl);
+        close(st);
+    }
+
+    set_rlimits(c->mem_mb);
+
+    execve(c->path, c->argv, c->envp);
+    constexpr char msg[] = "execvp: exec failed\n";
+    (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    _exit(127);
+}
+
+pid_t launch_child(ChildSpec& spec, std::vector<char>& stack,
+                   int* pidfd = nullptr) {
+    constexpr int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+    char* top = stack.data() + stack.size();
+    if (!pidfd) {
+        return clone(child_main, top, flags, &spec);
+    }
+    *pidfd = -1;
+    pid_t pid = clone(child_main, top, flags | CLONE_PIDFD, &spec, pidfd);
+    if (pid < 0 && errno == EINVAL) {
+        pid = clone(child_main, top, flags, &spec);
+        if (pid > 0) {
+            *pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
         }
-    };
+    }
+    return pid;
+}
+} // namespace
 
-    if (need_file) {
-        tmpFd = mktemp_file(tmpPath, "fuzz");
-        if (tmpFd < 0) {
-            R.exit_code = -1;
-            R.err = "mktemp_file failed";
-            cleanup_tmp();
-            return R;
+void TailBuffer::append(const char* p, size_t n) {
+    if (n > kSize) {
+        len_ += n - kSize;
+        p += n - kSize;
+        n = kSize;
+    }
+    const size_t pos = len_ % kSize;
+    const size_t first = std::min(n, kSize - pos);
+    std::memcpy(buf_.data() + pos, p, first);
+    std::memcpy(buf_.data(), p + first, n - first);
+    len_ += n;
+}
+
+std::string TailBuffer::str() const {
+    if (len_ <= kSize) {
+        return {buf_.data(), len_};
+    }
+    const size_t pos = len_ % kSize;
+    std::string s(buf_.data() + pos, kSize - pos);
+    s.append(buf_.data(), pos);
+    return s;
+}
+
+bool TailBuffer::contains(const std::string_view s) const {
+    if (len_ <= kSize) {
+        return std::string_view(buf_.data(), len_).find(s) !=
+            std::string_view::npos;
+    }
+    const size_t pos = len_ % kSize;
+    const std::string_view head(buf_.data() + pos, kSize - pos);
+    const std::string_view tail(buf_.data(), pos);
+    if (head.find(s) != std::string_view::npos ||
+        tail.find(s) != std::string_view::npos) {
+        return true;
+    }
+    for (size_t k = 1; k < s.size(); ++k) {
+        if (head.ends_with(s.substr(0, k)) && tail.starts_with(s.substr(k))) {
+            return true;
         }
-        ssize_t off = 0;
-        while (off < static_cast<ssize_t>(data.size())) {
-            ssize_t w = write(tmpFd, data.data() + off, data.size() - off);
-            if (w <= 0) {
-                if (w < 0 && errno == EINTR) {
-                    continue;
-                }
-                R.exit_code = -1;
-                R.err = "write(tmpfile) failed";
-                cleanup_tmp();
-                return R;
-            }
-            off += w;
+    }
+    return false;
+}
+
+Executor::Executor(const ExecConfig cfg) : cfg_(cfg) {
+    if (cfg_.mode == ExecMode::Persistent) {
+        cfg_.delivery = Delivery::Shm;
+    }
+}
+
+Executor::~Executor() {
+    if (pid_ > 0) {
+        kill(-pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+    }
+    for (int* fd : {&out_rd_, &err_rd_, &in_wr_, &pidfd_}) {
+        close_fd(*fd);
+    }
+    cleanup_tmp();
+    stop_forksrv();
+    release_input_shm();
+    close_fd(memfd_);
+    close_fd(devnull_fd_);
+    close_fd(timer_fd_);
+    close_fd(epfd_);
+}
+
+ExecResult Executor::run(
+    const std::vector<std::string>& argv_t,
+    const std::vector<uint8_t>& data) {
+    start(argv_t, data);
+    while (!step(-1)) {
+    }
+    return finish();
+}
+
+void Executor::start(const std::vector<std::string>& argv_t,
+                     const std::vector<uint8_t>& data) {
+    ignore_sigpipe();
+    data_ = &data;
+    res_ = {};
+    done_ = false;
+
+    if (cfg_.delivery == Delivery::Shm && !in_shm_ && !setup_input_shm()) {
+        logx::warn("input shm setup failed, falling back to file delivery");
+        cfg_.delivery = Delivery::File;
+    }
+    if (cfg_.delivery == Delivery::Memfd && memfd_ < 0) {
+        memfd_ = memfd_create("fuzz_input", MFD_CLOEXEC);
+        if (memfd_ < 0) {
+            logx::warn("memfd_create failed, falling back to file delivery");
+            cfg_.delivery = Delivery::File;
         }
-        fsync(tmpFd);
-        lseek(tmpFd, 0, SEEK_SET);
-        close(tmpFd);
-        tmpFd = -1;
     }
 
-    for (const auto& t : argv_t) {
-        if (t == "@@") {
-            args.push_back(tmpPath);
-        } else if (t == "{stdin}") {} else {
-            args.push_back(t);
+    if (!prepared_ && !prepare(argv_t)) {
+        res_.exit_code = -1;
+        res_.err = args_.empty() ? "empty argv" : "epoll/timerfd setup failed";
+        done_ = true;
+        return;
+    }
+
+    out_tail_.clear();
+    err_tail_.clear();
+    if (cfg_.mode != ExecMode::Spawn && !srv_failed_) {
+        if (srv_pid_ < 0 && !start_forksrv()) {
+            srv_failed_ = true;
+            logx::warn("fork server handshake failed, falling back to spawn");
+        }
+        if (srv_pid_ >= 0) {
+            begin_forksrv();
+            return;
         }
     }
+    begin_spawn();
+}
 
-    if (args.empty()) {
-        R.err = "empty argv";
-        R.exit_code = -1;
-        cleanup_tmp();
-        return R;
+bool Executor::step(int wait_ms) {
+    if (done_) {
+        return true;
+    }
+    if (wait_ms < 0) {
+        wait_ms = wait_hint_ms();
     }
+    epoll_event evs[6];
+    const int n = epoll_wait(epfd_, evs, 6, wait_ms);
+    if (n < 0 && errno != EINTR) {
+        if (srv_run_) {
+            fail_forksrv("forkserver: epoll_wait failed");
+        } else {
+            kill(-pid_, SIGKILL);
+            waitpid(pid_, nullptr, 0);
+            res_.exit_code = -1;
+            end_spawn();
+            res_.err = "epoll_wait failed";
+        }
+        return true;
+    }
+    if (srv_run_) {
+        step_forksrv(evs, std::max(n, 0));
+    } else {
+        step_spawn(evs, std::max(n, 0));
+    }
+    return done_;
+}
 
-    int in_pipe[2]{-1, -1}, out_pipe[2]{-1, -1}, err_pipe[2]{-1, -1};
+int Executor::wait_hint_ms() const {
+    // Without a pidfd, spawned children are reaped by 1 ms waitpid polling.
+    return !done_ && !srv_run_ && pidfd_ < 0 ? 1 : -1;
+}
 
-    if (pipe(in_pipe) < 0) {
-        R.exit_code = -1;
-        R.err = "pipe() failed: in";
-        cleanup_tmp();
-        return R;
+ExecResult Executor::finish() {
+    ExecResult R = std::move(res_);
+    res_ = {};
+    if (R.timed_out && cfg_.hang_ms > 0) {
+        // Suspected hang: confirm once at the longer limit, on a clean map
+        // so a finished re-run does not report the killed run's edges.
+        if (cfg_.cov) {
+            cfg_.cov->reset();
+        }
+        ExecResult F = rerun(std::max(cfg_.hang_ms, cfg_.timeout_ms * 2));
+        return F.exit_code < 0 ? R : F;
     }
-    if (pipe(out_pipe) < 0) {
-        close(in_pipe[0]);
-        close(in_pipe[1]);
-        R.exit_code = -1;
-        R.err = "pipe() failed: out";
-        cleanup_tmp();
+    if (!wants_rerun(R)) {
         return R;
     }
-    if (pipe(err_pipe) < 0) {
-        close(in_pipe[0]);
-        close(in_pipe[1]);
-        close(out_pipe[0]);
-        close(out_pipe[1]);
-        R.exit_code = -1;
-        R.err = "pipe() failed: err";
-        cleanup_tmp();
+
+    // Looks like a crash: replay once with full capture for triage.
+    if (cfg_.cov) {
+        cfg_.cov->reset();
+    }
+    ExecResult F = rerun(cfg_.timeout_ms);
+    if (F.exit_code < 0 || (is_clean(F) && !has_report(F))) {
         return R;
     }
+    return F;
+}
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        R.exit_code = -1;
-        R.err = "fork() failed";
-        close(in_pipe[0]);
-        close(in_pipe[1]);
-        close(out_pipe[0]);
-        close(out_pipe[1]);
-        close(err_pipe[0]);
-        close(err_pipe[1]);
-        cleanup_tmp();
-        return R;
+ExecResult Executor::rerun(const int timeout_ms) {
+    const int saved_ms = cfg_.timeout_ms;
+    const Capture saved = cfg_.capture;
+    cfg_.timeout_ms = timeout_ms;
+    cfg_.capture = Capture::Full;
+    done_ = false;
+    if (srv_pid_ >= 0 && srv_out_fd_ >= 0) {
+        begin_forksrv();
+    } else {
+        begin_spawn();
+    }
+    while (!step(-1)) {
     }
+    cfg_.timeout_ms = saved_ms;
+    cfg_.capture = saved;
+    ExecResult F = std::move(res_);
+    res_ = {};
+    return F;
+}
 
-    if (pid == 0) {
-        setsid();
-        (void)setpgid(0, 0);
+bool Executor::prepare(const std::vector<std::string>& argv_t) {
+    scan_argv(argv_t, need_file_, use_stdin_);
 
-        if (use_stdin) {
-            dup2(in_pipe[0], STDIN_FILENO);
-        } else {
-            if (int devnull = open("/dev/null", O_RDONLY); devnull >= 0) {
-                dup2(devnull, STDIN_FILENO);
-                close(devnull);
+    args_.clear();
+    file_args_.clear();
+    for (const auto& t : argv_t) {
+        if (t == "@@") {
+            file_args_.push_back(args_.size());
+            args_.emplace_back(cfg_.delivery == Delivery::File
+                                   ? ""
+                                   : kInputFilePath);
+        } else if (t != "{stdin}") {
+            args_.push_back(t);
+        }
+    }
+    if (args_.empty()) {
+        return false;
+    }
+    if (cfg_.exe_path && *cfg_.exe_path) {
+        exe_ = cfg_.exe_path;
+    } else if (!resolve_executable(args_[0], exe_)) {
+        exe_ = args_[0];
+    }
+
+    argv_.clear();
+    for (auto& a : args_) {
+        argv_.push_back(a.data());
+    }
+    argv_.push_back(nullptr);
+
+    auto is_ours = [](const std::string_view kv) {
+        for (const std::string_view k : {
+                 kCoverageVar, kForkSrvVar, kInputVar, kPersistVar,
+                 kInputBackVar, kCmpLogVar
+             }) {
+            if (kv.size() > k.size() && kv.starts_with(k) &&
+                kv[k.size()] == '=') {
+                return true;
             }
         }
+        return false;
+    };
+    env_.clear();
+    for (char** e = environ; e && *e; ++e) {
+        if (!is_ours(*e)) {
+            env_.emplace_back(*e);
+        }
+    }
+    if (cfg_.cov_shm_name && *cfg_.cov_shm_name) {
+        env_.push_back(std::string(kCoverageVar) + "=" + cfg_.cov_shm_name);
+    }
+    if (cfg_.cmplog_shm_name && *cfg_.cmplog_shm_name) {
+        env_.push_back(std::string(kCmpLogVar) + "=" + cfg_.cmplog_shm_name);
+    }
+    if (cfg_.delivery == Delivery::Shm) {
+        env_.push_back(std::string(kInputVar) + "=" + in_shm_name_);
+        env_.push_back(std::string(kInputBackVar) + "=" +
+                       std::to_string(input_back_flags(argv_t)));
+    }
+    const size_t n_spawn = env_.size();
+    env_.push_back(std::string(kForkSrvVar) + "=1");
+    if (cfg_.mode == ExecMode::Persistent) {
+        env_.push_back(std::string(kPersistVar) + "=" +
+                       std::to_string(std::max(cfg_.persist_iters, 1)));
+    }
 
-        dup2(out_pipe[1], STDOUT_FILENO);
-        dup2(err_pipe[1], STDERR_FILENO);
+    envp_.clear();
+    srv_envp_.clear();
+    for (size_t i = 0; i < env_.size(); ++i) {
+        if (i < n_spawn) {
+            envp_.push_back(env_[i].data());
+        }
+        srv_envp_.push_back(env_[i].data());
+    }
+    envp_.push_back(nullptr);
+    srv_envp_.push_back(nullptr);
 
-        close(in_pipe[0]);
-        close(in_pipe[1]);
-        close(out_pipe[0]);
-        close(out_pipe[1]);
-        close(err_pipe[0]);
-        close(err_pipe[1]);
+    child_stack_.resize(64 * 1024);
+    if (devnull_fd_ < 0) {
+        devnull_fd_ = open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+    if (epfd_ < 0) {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_CLOEXEC | TFD_NONBLOCK);
+        if (epfd_ < 0 || timer_fd_ < 0 ||
+            !ep_add(epfd_, timer_fd_, EPOLLIN, kEvTimer)) {
+            return false;
+        }
+    }
+    prepared_ = true;
+    return true;
+}
+
+bool Executor::setup_input_shm() {
+    static std::atomic<uint32_t> g_in_cnt{0};
+    char name_buf[48];
+    snprintf(name_buf, sizeof(name_buf), "/fuzz_in_%d_%u", getpid(),
+             ++g_in_cnt);
+    in_shm_name_.assign(name_buf);
+
+    in_shm_fd_ = shm_open(in_shm_name_.c_str(), O_CREAT | O_RDWR, 0600);
+    if (in_shm_fd_ < 0) {
+        in_shm_name_.clear();
+        return false;
+    }
+    in_shm_size_ = kInputHdrSize + std::max<size_t>(cfg_.input_cap, 4096);
+    if (ftruncate(in_shm_fd_, static_cast<off_t>(in_shm_size_)) < 0) {
+        release_input_shm();
+        return false;
+    }
+    void* map = mmap(nullptr, in_shm_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, in_shm_fd_, 0);
+    if (map == MAP_FAILED) {
+        release_input_shm();
+        return false;
+    }
+    in_shm_ = static_cast<uint8_t*>(map);
+    return true;
+}
+
+void Executor::release_input_shm() {
+    if (in_shm_) {
+        munmap(in_shm_, in_shm_size_);
+        in_shm_ = nullptr;
+    }
+    close_fd(in_shm_fd_);
+    if (!in_shm_name_.empty()) {
+        shm_unlink(in_shm_name_.c_str());
+        in_shm_name_.clear();
+    }
+}
+
+void Executor::write_input_shm(const std::vector<uint8_t>& data) {
+    const size_t n = std::min(data.size(), in_shm_size_ - kInputHdrSize);
+    std::memcpy(in_shm_ + kInputHdrSize, data.data(), n);
+    const auto len = static_cast<uint32_t>(n);
+    std::memcpy(in_shm_, &len, sizeof(len));
+}
+
+bool Executor::drain(const int fd, std::string& full, TailBuffer& tail) const {
+    if (fd < 0) {
+        return true;
+    }
+    if (cfg_.capture == Capture::Full) {
+        return drain_fd(fd, [&](const char* p, const size_t n) {
+            full.append(p, n);
+        });
+    }
+    return drain_fd(fd, [&](const char* p, const size_t n) {
+        tail.append(p, n);
+    });
+}
 
-        set_rlimits(cfg_.mem_mb);
+void Executor::fill_output(ExecResult& R, std::string& outS,
+                           std::string& errS) const {
+    if (cfg_.capture == Capture::Full) {
+        R.out = std::move(outS);
+        R.err = std::move(errS);
+    } else if (!is_clean(R)) {
+        R.out = out_tail_.str();
+        R.err = err_tail_.str();
+    } else if (err_tail_.contains("Sanitizer")) {
+        // The SUMMARY line sits near the end of a report, within the tail.
+        R.out = out_tail_.str();
+        R.err = err_tail_.str();
+    }
+}
+
+bool Executor::wants_rerun(const ExecResult& R) const {
+    if (cfg_.capture == Capture::Full || R.timed_out || R.exit_code < 0) {
+        return false;
+    }
+    if (R.term_sig) {
+        return true;
+    }
+    if (R.exit_code == 0) {
+        return has_report(R);
+    }
+    if (std::ranges::find(cfg_.allowed_exits, R.exit_code) ==
+        cfg_.allowed_exits.end()) {
+        return true;
+    }
+    // An allowed exit code may still carry a sanitizer report.
+    return cfg_.capture == Capture::Discard || has_report(R);
+}
+
+int Executor::input_back_flags(const std::vector<std::string>& argv_t) const {
+    if (cfg_.delivery != Delivery::Shm) {
+        return 0;
+    }
+    bool need_file = false, use_stdin = false;
+    scan_argv(argv_t, need_file, use_stdin);
+    // Persistent harnesses read __fuzz_input() unless {stdin} is explicit.
+    if (cfg_.mode == ExecMode::Persistent &&
+        std::ranges::find(argv_t, "{stdin}") == argv_t.end()) {
+        use_stdin = false;
+    }
+    return (use_stdin ? kInputBackStdin : 0) |
+        (need_file ? kInputBackFile : 0);
+}
 
-        if (cfg_.cov_shm_name && *cfg_.cov_shm_name) {
-            setenv(kCoverageVar, cfg_.cov_shm_name, 1);
+bool Executor::start_forksrv() {
+    const bool shm = cfg_.delivery == Delivery::Shm;
+    const bool memfd = cfg_.delivery == Delivery::Memfd;
+    const bool capture = cfg_.capture != Capture::Discard;
+    if (cfg_.delivery == Delivery::File) {
+        srv_in_fd_ = mktemp_file(srv_in_path_, "fuzz");
+        if (srv_in_fd_ < 0) {
+            return false;
+        }
+        fcntl(srv_in_fd_, F_SETFD, FD_CLOEXEC);
+        for (const size_t i : file_args_) {
+            argv_[i] = srv_in_path_.data();
         }
+    }
 
-        std::vector<char*> av;
-        av.reserve(args.size() + 1);
-        for (auto& s : args) {
-            av.push_back(const_cast<char*>(s.c_str()));
+    int ctl_pipe[2]{-1, -1}, st_pipe[2]{-1, -1};
+    int out_pipe[2]{-1, -1}, err_pipe[2]{-1, -1};
+    auto close_pipes = [&] {
+        for (int* p : {ctl_pipe, st_pipe, out_pipe, err_pipe}) {
+            close_fd(p[0]);
+            close_fd(p[1]);
         }
-        av.push_back(nullptr);
+    };
+    if (pipe2(ctl_pipe, O_CLOEXEC) < 0 || pipe2(st_pipe, O_CLOEXEC) < 0 ||
+        (capture && (pipe2(out_pipe, O_CLOEXEC) < 0 ||
+                     pipe2(err_pipe, O_CLOEXEC) < 0))) {
+        close_pipes();
+        stop_forksrv();
+        return false;
+    }
+
+    ChildSpec spec;
+    spec.path = exe_.c_str();
+    spec.argv = argv_.data();
+    spec.envp = srv_envp_.data();
+    spec.in_fd = devnull_fd_;
+    if (use_stdin_ && !shm) {
+        spec.in_fd = memfd ? memfd_ : srv_in_fd_;
+    }
+    spec.out_fd = capture ? out_pipe[1] : devnull_fd_;
+    spec.err_fd = capture ? err_pipe[1] : devnull_fd_;
+    spec.file_fd = memfd && need_file_ ? memfd_ : -1;
+    spec.ctl_fd = ctl_pipe[0];
+    spec.st_fd = st_pipe[1];
+    spec.mem_mb = cfg_.mem_mb;
 
-        execvp(av[0], av.data());
-        std::perror("execvp");
-        _exit(127);
+    const pid_t pid = launch_child(spec, child_stack_);
+    if (pid < 0) {
+        close_pipes();
+        stop_forksrv();
+        return false;
     }
 
-    close(in_pipe[0]);
-    close(out_pipe[1]);
-    close(err_pipe[1]);
+    srv_pid_ = pid;
+    srv_ctl_fd_ = ctl_pipe[1];
+    srv_st_fd_ = st_pipe[0];
+    srv_out_fd_ = out_pipe[0];
+    srv_err_fd_ = err_pipe[0];
+    close_fd(ctl_pipe[0]);
+    close_fd(st_pipe[1]);
+    close_fd(out_pipe[1]);
+    close_fd(err_pipe[1]);
+    set_nonblock(srv_st_fd_);
+    if (capture) {
+        set_nonblock(srv_out_fd_);
+        set_nonblock(srv_err_fd_);
+    }
+    if (!ep_add(epfd_, srv_st_fd_, EPOLLIN, kEvStatus) ||
+        (capture && (!ep_add(epfd_, srv_out_fd_, EPOLLIN, kEvOut) ||
+                     !ep_add(epfd_, srv_err_fd_, EPOLLIN, kEvErr)))) {
+        stop_forksrv();
+        return false;
+    }
 
-    set_nonblock(out_pipe[0]);
-    set_nonblock(err_pipe[0]);
-    if (use_stdin && in_pipe[1] != -1) {
-        set_nonblock(in_pipe[1]);
+    const int handshake_ms = std::max(cfg_.timeout_ms * 10, 2000);
+    const uint64_t start = now_mono_ms();
+    auto discard = [](const char*, size_t) {};
+    uint32_t hello = 0;
+    size_t got = 0;
+    while (got < sizeof(hello)) {
+        const int elapsed = static_cast<int>(now_mono_ms() - start);
+        if (elapsed >= handshake_ms) {
+            break;
+        }
+        pollfd pfds[3] = {
+            {srv_st_fd_, POLLIN, 0}, {srv_out_fd_, POLLIN, 0},
+            {srv_err_fd_, POLLIN, 0}
+        };
+        if (poll(pfds, 3, handshake_ms - elapsed) < 0 && errno != EINTR) {
+            break;
+        }
+        if (capture) {
+            drain_fd(srv_out_fd_, discard);
+            drain_fd(srv_err_fd_, discard);
+        }
+        const ssize_t r = read(srv_st_fd_,
+                               reinterpret_cast<char*>(&hello) + got,
+                               sizeof(hello) - got);
+        if (r > 0) {
+            got += static_cast<size_t>(r);
+        } else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+            break;
+        }
     }
 
-    if (use_stdin && data.empty() && in_pipe[1] != -1) {
-        close(in_pipe[1]);
-        in_pipe[1] = -1;
+    if (got != sizeof(hello) || hello != kForkSrvHello) {
+        stop_forksrv();
+        return false;
     }
+    return true;
+}
 
-    size_t in_off = 0;
-    uint64_t start = now_mono_ms();
-    std::string outS, errS;
+void Executor::stop_forksrv() {
+    if (srv_pid_ > 0) {
+        kill(-srv_pid_, SIGKILL);
+        kill(srv_pid_, SIGKILL);
+        waitpid(srv_pid_, nullptr, 0);
+        srv_pid_ = -1;
+    }
+    close_fd(srv_ctl_fd_);
+    close_fd(srv_st_fd_);
+    close_fd(srv_out_fd_);
+    close_fd(srv_err_fd_);
+    close_fd(srv_in_fd_);
+    if (!srv_in_path_.empty()) {
+        unlink(srv_in_path_.c_str());
+        srv_in_path_.clear();
+    }
+}
 
-    auto drain = [](const int fd, std::string& dst) {
-        char buf[8192];
-        while (true) {
-            const ssize_t r = read(fd, buf, sizeof(buf));
-            if (r > 0) {
-                dst.append(buf, buf + r);
-                continue;
+void Executor::fail_forksrv(const char* why) {
+    arm_timer(timer_fd_, 0);
+    stop_forksrv();
+    srv_run_ = false;
+    res_.exit_code = -1;
+    res_.err = why;
+    done_ = true;
+}
+
+void Executor::begin_forksrv() {
+    srv_run_ = true;
+    got_ = 0;
+    reply_ = {};
+    out_buf_.clear();
+    err_buf_.clear();
+
+    if (cfg_.delivery == Delivery::Shm) {
+        write_input_shm(*data_);
+    } else if (!rewrite_input_fd(
+        cfg_.delivery == Delivery::Memfd ? memfd_ : srv_in_fd_, *data_)) {
+        fail_forksrv("forkserver: write(input) failed");
+        return;
+    }
+
+    constexpr uint32_t req = 0;
+    t0_us_ = now_mono_us();
+    if (write(srv_ctl_fd_, &req, sizeof(req)) != sizeof(req)) {
+        fail_forksrv("forkserver: request failed");
+        return;
+    }
+    arm_timer(timer_fd_, cfg_.timeout_ms);
+}
+
+void Executor::step_forksrv(const epoll_event* evs, const int n) {
+    static_assert(sizeof(reply_) == 8);
+    for (int i = 0; i < n; ++i) {
+        switch (evs[i].data.u32) {
+        case kEvOut:
+            drain(srv_out_fd_, out_buf_, out_tail_);
+            break;
+        case kEvErr:
+            drain(srv_err_fd_, err_buf_, err_tail_);
+            break;
+        case kEvTimer: {
+            uint64_t ticks = 0;
+            (void)!read(timer_fd_, &ticks, sizeof(ticks));
+            if (res_.timed_out) {
+                fail_forksrv("forkserver: lost child");
+                return;
             }
-            if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if (got_ < sizeof(reply_.pid)) {
+                fail_forksrv("forkserver: no child");
+                return;
+            }
+            res_.timed_out = true;
+            kill(reply_.pid, SIGKILL);
+            arm_timer(timer_fd_, cfg_.timeout_ms + 1000);
+            break;
+        }
+        case kEvStatus: {
+            if (got_ == sizeof(reply_)) {
                 break;
             }
+            const ssize_t r = read(srv_st_fd_,
+                                   reinterpret_cast<char*>(&reply_) + got_,
+                                   sizeof(reply_) - got_);
+            if (r > 0) {
+                got_ += static_cast<size_t>(r);
+            } else if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+                fail_forksrv("forkserver: server died");
+                return;
+            }
             break;
         }
-    };
-
-    while (true) {
-        pollfd pfds[3];
-        int nfds = 0;
-        if (in_pipe[1] != -1) {
-            pfds[nfds++] = pollfd{in_pipe[1], POLLOUT, 0};
+        default:
+            break;
         }
-        pfds[nfds++] = pollfd{out_pipe[0], POLLIN, 0};
-        pfds[nfds++] = pollfd{err_pipe[0], POLLIN, 0};
+    }
+    if (got_ < sizeof(reply_)) {
+        return;
+    }
+    arm_timer(timer_fd_, 0);
+    res_.wall_us = now_mono_us() - t0_us_;
 
-        int elapsed = static_cast<int>(now_mono_ms() - start);
-        int rem = std::max(1, cfg_.timeout_ms - elapsed);
+    drain(srv_out_fd_, out_buf_, out_tail_);
+    drain(srv_err_fd_, err_buf_, err_tail_);
 
-        if (int pr = poll(pfds, nfds, rem); pr < 0 && errno == EINTR) {
-            continue;
+    if (!res_.timed_out) {
+        // WIFSTOPPED: one persistent iteration finished, reported as exit 0.
+        if (WIFEXITED(reply_.status)) {
+            res_.exit_code = WEXITSTATUS(reply_.status);
         }
+        if (WIFSIGNALED(reply_.status)) {
+            res_.term_sig = WTERMSIG(reply_.status);
+        }
+    }
+    fill_output(res_, out_buf_, err_buf_);
+    srv_run_ = false;
+    done_ = true;
+}
 
-        drain(out_pipe[0], outS);
-        drain(err_pipe[0], errS);
+void Executor::cleanup_tmp() {
+    if (!tmp_path_.empty()) {
+        unlink(tmp_path_.c_str());
+        tmp_path_.clear();
+    }
+}
 
-        if (use_stdin && in_pipe[1] != -1 && in_off < data.size()) {
-            ssize_t w = write(in_pipe[1], data.data() + in_off,
-                              data.size() - in_off);
-            if (w > 0) {
-                in_off += static_cast<size_t>(w);
-            }
-            if (w < 0 && errno != EAGAIN && errno != EINTR) {
-                close(in_pipe[1]);
-                in_pipe[1] = -1;
-            }
-            if (in_off == data.size()) {
-                close(in_pipe[1]);
-                in_pipe[1] = -1;
-            }
-        }
+void Executor::begin_spawn() {
+    const std::vector<uint8_t>& data = *data_;
+    ExecResult& R = res_;
+    srv_run_ = false;
+    pid_ = -1;
+    in_off_ = 0;
+    out_buf_.clear();
+    err_buf_.clear();
 
-        int st = 0;
-        if (pid_t wp = waitpid(pid, &st, WNOHANG); wp == pid) {
-            if (WIFEXITED(st)) {
-                R.exit_code = WEXITSTATUS(st);
-            }
-            if (WIFSIGNALED(st)) {
-                R.term_sig = WTERMSIG(st);
+    auto fail = [&](const char* why) {
+        R.exit_code = -1;
+        R.err = why;
+        cleanup_tmp();
+        done_ = true;
+    };
+
+    const bool file = cfg_.delivery == Delivery::File;
+    if (cfg_.delivery == Delivery::Shm) {
+        write_input_shm(data);
+    } else if (cfg_.delivery == Delivery::Memfd &&
+        !rewrite_input_fd(memfd_, data)) {
+        fail("write(memfd) failed");
+        return;
+    }
+    const bool need_file = file && need_file_;
+    const bool use_stdin = file && use_stdin_;
+    const bool capture = cfg_.capture != Capture::Discard;
+
+    if (need_file) {
+        int tmpFd = mktemp_file(tmp_path_, "fuzz");
+        if (tmpFd < 0) {
+            fail("mktemp_file failed");
+            return;
+        }
+        ssize_t off = 0;
+        while (off < static_cast<ssize_t>(data.size())) {
+            ssize_t w = write(tmpFd, data.data() + off, data.size() - off);
+            if (w <= 0) {
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                close(tmpFd);
+                fail("write(tmpfile) failed");
+                return;
             }
-            drain(out_pipe[0], outS);
-            drain(err_pipe[0], errS);
-            break;
+            off += w;
         }
+        fsync(tmpFd);
+        close(tmpFd);
+        for (const size_t i : file_args_) {
+            argv_[i] = tmp_path_.data();
+        }
+    }
 
-        if (static_cast<int>(now_mono_ms() - start) >= cfg_.timeout_ms) {
-            R.timed_out = true;
-            kill(-pid, SIGKILL);
-            waitpid(pid, nullptr, 0);
-            break;
+    int in_pipe[2]{-1, -1}, out_pipe[2]{-1, -1}, err_pipe[2]{-1, -1};
+    auto close_pipes = [&] {
+        for (int* p : {in_pipe, out_pipe, err_pipe}) {
+            close_fd(p[0]);
+            close_fd(p[1]);
         }
+    };
+
+    if (use_stdin && pipe2(in_pipe, O_CLOEXEC) < 0) {
+        fail("pipe() failed: in");
+        return;
+    }
+    if (capture && pipe2(out_pipe, O_CLOEXEC) < 0) {
+        close_pipes();
+        fail("pipe() failed: out");
+        return;
+    }
+    if (capture && pipe2(err_pipe, O_CLOEXEC) < 0) {
+        close_pipes();
+        fail("pipe() failed: err");
+        return;
     }
 
-    R.out = std::move(outS);
-    R.err = std::move(errS);
+    ChildSpec spec;
+    spec.path = exe_.c_str();
+    spec.argv = argv_.data();
+    spec.envp = envp_.data();
+    spec.in_fd = devnull_fd_;
+    if (use_stdin) {
+        spec.in_fd = in_pipe[0];
+    } else if (cfg_.delivery == Delivery::Memfd && use_stdin_) {
+        spec.in_fd = memfd_;
+    }
+    spec.out_fd = capture ? out_pipe[1] : devnull_fd_;
+    spec.err_fd = capture ? err_pipe[1] : devnull_fd_;
+    spec.file_fd = cfg_.delivery == Delivery::Memfd && need_file_
+                       ? memfd_
+                       : -1;
+    spec.mem_mb = cfg_.mem_mb;
 
-    if (in_pipe[0] != -1) {
-        close(in_pipe[0]);
+    t0_us_ = now_mono_us();
+    pid_ = launch_child(spec, child_stack_, &pidfd_);
+    if (pid_ < 0) {
+        close_pipes();
+        fail("fork() failed");
+        return;
     }
-    if (in_pipe[1] != -1) {
-        close(in_pipe[1]);
+
+    close_fd(in_pipe[0]);
+    close_fd(out_pipe[1]);
+    close_fd(err_pipe[1]);
+    in_wr_ = in_pipe[1];
+    out_rd_ = out_pipe[0];
+    err_rd_ = err_pipe[0];
+
+    if (capture) {
+        set_nonblock(out_rd_);
+        set_nonblock(err_rd_);
+        ep_add(epfd_, out_rd_, EPOLLIN, kEvOut);
+        ep_add(epfd_, err_rd_, EPOLLIN, kEvErr);
     }
-    if (out_pipe[0] != -1) {
-        close(out_pipe[0]);
+    if (in_wr_ != -1 && data.empty()) {
+        close_fd(in_wr_);
     }
-    if (out_pipe[1] != -1) {
-        close(out_pipe[1]);
+    if (in_wr_ != -1) {
+        set_nonblock(in_wr_);
+        ep_add(epfd_, in_wr_, EPOLLOUT, kEvIn);
     }
-    if (err_pipe[0] != -1) {
-        close(err_pipe[0]);
+    if (pidfd_ >= 0) {
+        ep_add(epfd_, pidfd_, EPOLLIN, kEvChild);
     }
-    if (err_pipe[1] != -1) {
-        close(err_pipe[1]);
+    arm_timer(timer_fd_, cfg_.timeout_ms);
+}
+
+void Executor::drop_fd(int& fd) const {
+    if (fd != -1) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        close_fd(fd);
     }
+}
+
+void Executor::step_spawn(const epoll_event* evs, const int n) {
+    const std::vector<uint8_t>& data = *data_;
+    bool check_child = pidfd_ < 0;
+    for (int i = 0; i < n; ++i) {
+        switch (evs[i].data.u32) {
+        case kEvOut:
+            if (drain(out_rd_, out_buf_, out_tail_)) {
+                drop_fd(out_rd_);
+            }
+            break;
+        case kEvErr:
+            if (drain(err_rd_, err_buf_, err_tail_)) {
+                drop_fd(err_rd_);
+            }
+            break;
+        case kEvIn: {
+            if (in_wr_ == -1) {
+                break;
+            }
+            const ssize_t w = write(in_wr_, data.data() + in_off_,
+                                    data.size() - in_off_);
+            if (w > 0) {
+                in_off_ += static_cast<size_t>(w);
+            }
+            if ((w < 0 && errno != EAGAIN && errno != EINTR) ||
+                in_off_ == data.size()) {
+                drop_fd(in_wr_);
+            }
+            break;
+        }
+        case kEvChild:
+            check_child = true;
+            break;
+        case kEvTimer: {
+            uint64_t ticks = 0;
+            (void)!read(timer_fd_, &ticks, sizeof(ticks));
+            res_.timed_out = true;
+            kill(-pid_, SIGKILL);
+            waitpid(pid_, nullptr, 0);
+            end_spawn();
+            return;
+        }
+        default:
+            break;
+        }
+    }
+
+    int st = 0;
+    rusage ru{};
+    if (check_child && wait4(pid_, &st, WNOHANG, &ru) == pid_) {
+        res_.cpu_us = static_cast<uint64_t>(ru.ru_utime.tv_sec +
+                                            ru.ru_stime.tv_sec) * 1000000ull +
+            static_cast<uint64_t>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+        if (WIFEXITED(st)) {
+            res_.exit_code = WEXITSTATUS(st);
+        }
+        if (WIFSIGNALED(st)) {
+            res_.term_sig = WTERMSIG(st);
+        }
+        end_spawn();
+    }
+}
+
+void Executor::end_spawn() {
+    arm_timer(timer_fd_, 0);
+    res_.wall_us = now_mono_us() - t0_us_;
+    drain(out_rd_, out_buf_, out_tail_);
+    drain(err_rd_, err_buf_, err_tail_);
+    drop_fd(out_rd_);
+    drop_fd(err_rd_);
+    drop_fd(in_wr_);
+    drop_fd(pidfd_);
+    pid_ = -1;
 
+    fill_output(res_, out_buf_, err_buf_);
     cleanup_tmp();
-    return R;
+    done_ = true;
 }
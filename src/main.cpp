@@ -1,13 +1,21 @@
+#include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cerrno>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <mutex>
+#include <string_view>
 #include <thread>
 #include <unistd.h>
 #include <unordered_set>
 
+#include "affinity.h"
+#include "async_executor.h"
+#include "calibration.h"
+#include "cmplog.h"
 #include "corpus.h"
 #include "coverage.h"
 #include "crash.h"
@@ -23,12 +31,29 @@ static void usage(const char* prog) {
         "Usage: %s --target \"./prog @@/{stdin}\" --seeds dir --out dir [opts]\n"
         "  --iterations N        total testcases (default 10000)\n"
         "  --threads N           parallel workers (default 1)\n"
-        "  --timeout-ms N        per-run timeout (default 1000)\n"
+        "  --timeout-ms N        per-run timeout (default: calibrated)\n"
         "  --mem-mb N            RLIMIT_AS in MB (default 0 unlimited)\n"
         "  --max-size N          max testcase bytes (default 4096)\n"
         "  --dict path           dictionary file\n"
         "  --seed N              rng seed (default random)\n"
-        "  --allowed-exits       e.g. 1,2,3 treated as non-crash\n", prog);
+        "  --allowed-exits       e.g. 1,2,3 treated as non-crash\n"
+        "  --forkserver          reuse an instrumented target's fork server\n"
+        "  --persistent N        run N inputs per process via __fuzz_loop\n"
+        "  --input MODE          file (tmpfile/pipe), memfd, or shm (needs\n"
+        "                        cov_runtime); default file\n"
+        "  --capture MODE        discard, tail or full target output; crashes\n"
+        "                        are re-run with full capture (default tail);\n"
+        "                        discard misses reports on a zero exit\n"
+        "  --inflight K          target runs kept in flight per worker\n"
+        "                        (default 1)\n"
+        "  --bind                pin each worker to a free core\n"
+        "  --cpu LIST            pin workers to these cores, e.g. 0,2-5\n"
+        "  --cmplog              log compare operands (trace-cmp) and try\n"
+        "                        them in place of matching input bytes\n"
+        "  --value-profile       count closer compare operands as coverage\n"
+        "  --resume              replay --out's queue and reload its crash\n"
+        "                        signatures before fuzzing\n",
+        prog);
 }
 
 bool parse_options(const int argc, char** argv, Options& o, std::string& err) {
@@ -92,6 +117,52 @@ bool parse_options(const int argc, char** argv, Options& o, std::string& err) {
                 return false;
             }
             o.seed = static_cast<uint64_t>(std::stoull(argv[++i]));
+        } else if (a == "--forkserver") {
+            o.fork_server = true;
+        } else if (a == "--persistent") {
+            if (!need(1)) {
+                return false;
+            }
+            o.persistent = std::stoi(argv[++i]);
+        } else if (a == "--input") {
+            if (!need(1)) {
+                return false;
+            }
+            o.input_mode = argv[++i];
+            if (o.input_mode != "file" && o.input_mode != "shm" &&
+                o.input_mode != "memfd") {
+                err = "unknown input mode: " + o.input_mode;
+                return false;
+            }
+        } else if (a == "--inflight") {
+            if (!need(1)) {
+                return false;
+            }
+            o.inflight = std::stoi(argv[++i]);
+        } else if (a == "--cmplog") {
+            o.cmplog = true;
+        } else if (a == "--value-profile") {
+            o.value_profile = true;
+        } else if (a == "--resume") {
+            o.resume = true;
+        } else if (a == "--bind") {
+            o.bind = true;
+        } else if (a == "--cpu") {
+            if (!need(1)) {
+                return false;
+            }
+            o.cpu_list = argv[++i];
+            o.bind = true;
+        } else if (a == "--capture") {
+            if (!need(1)) {
+                return false;
+            }
+            o.capture = argv[++i];
+            if (o.capture != "discard" && o.capture != "tail" &&
+                o.capture != "full") {
+                err = "unknown capture mode: " + o.capture;
+                return false;
+            }
         } else if (a == "--allowed-exits") {
             if (!need(1)) {
                 return false;
@@ -123,6 +194,9 @@ bool parse_options(const int argc, char** argv, Options& o, std::string& err) {
     if (o.threads < 1) {
         o.threads = 1;
     }
+    if (o.inflight < 1) {
+        o.inflight = 1;
+    }
     return true;
 }
 
@@ -134,11 +208,13 @@ struct Shared {
     std::atomic<uint64_t> crashes = 0;
     std::atomic<uint64_t> saved = 0;
     std::atomic<uint64_t> new_cov_inputs = 0;
-    std::vector<uint8_t> global_cov;
-    std::mutex cov_mu;
+    std::atomic<uint64_t> trimmed = 0; // bytes
+    VirginMap virgin;
+    PathSet paths;
+    TimeoutTuner tuner;
 
-    explicit Shared(const size_t max_size) :
-        corpus(max_size), global_cov(kCoverageSize, 0) {}
+    Shared(const size_t max_size, const int timeout_ms) :
+        corpus(max_size), tuner(timeout_ms) {}
 };
 
 static void save_crash(const std::string& out_dir, uint64_t id,
@@ -166,49 +242,275 @@ static void save_crash(const std::string& out_dir, uint64_t id,
     mf << "stdout:\n" << R.out << "\n--- stderr ---\n" << R.err << "\n";
 }
 
+// Saves an accepted input as queue/id-<id> with its metadata beside it.
+static void save_queue(const std::string& out_dir, const uint64_t id,
+                       const std::vector<uint8_t>& buf, const uint32_t score,
+                       const uint64_t parent, const CovDelta& d,
+                       const uint64_t exec_us, const size_t trimmed) {
+    const std::string base =
+        join_path(join_path(out_dir, "queue"), "id-" + std::to_string(id));
+    std::ofstream of(base, std::ios::binary);
+    of.write(reinterpret_cast<const char*>(buf.data()),
+             static_cast<std::streamsize>(buf.size()));
+    std::ofstream mf(base + ".meta.txt");
+    mf << "time: " << now_iso8601() << "\n";
+    mf << "score: " << score << "\n";
+    mf << "parent: " << parent << "\n";
+    mf << "new_edges: " << d.new_edges << " new_buckets: " << d.new_buckets
+        << " new_values: " << d.new_values << "\n";
+    mf << "exec_us: " << exec_us << "\n";
+    mf << "trimmed: " << trimmed << "\n";
+}
+
+// Map indices the run on cov hit, minus those known to vary between runs.
+static std::vector<uint32_t> covered_edges(const Shared& shared,
+                                           const Coverage& cov) {
+    std::vector<uint32_t> edges;
+    cov.entries(edges);
+    for (uint32_t& e : edges) {
+        e >>= 8;
+    }
+    std::erase_if(edges, [&](const uint32_t idx) {
+        return shared.virgin.is_variable(idx);
+    });
+    return edges;
+}
+
+constexpr size_t kTrimMinChunk = 4;
+
+// Removes power-of-two sized chunks, largest first, from a novel input as
+// long as its path hash stays the same. job.result then holds the last
+// accepted trial, so timings describe the trimmed input. Returns the bytes
+// removed.
+static size_t trim_input(const Shared& shared, AsyncExecutor& exec,
+                         AsyncExecutor::Job& job) {
+    std::vector<uint8_t>& in = job.input;
+    const uint64_t want = job.cov.path_hash(shared.virgin);
+    const size_t orig = in.size();
+    const size_t p2 = std::bit_ceil(orig);
+    std::vector<uint8_t> cand;
+    for (size_t chunk = std::max(p2 / 16, kTrimMinChunk);
+         chunk >= std::max(p2 / 1024, kTrimMinChunk); chunk /= 2) {
+        for (size_t pos = 0; pos < in.size() && in.size() > chunk;) {
+            const auto at = [&](const size_t i) {
+                return in.begin() +
+                    static_cast<std::ptrdiff_t>(std::min(i, in.size()));
+            };
+            cand.assign(in.begin(), at(pos));
+            cand.insert(cand.end(), at(pos + chunk), in.end());
+            std::swap(in, cand);
+            if (ExecResult R = exec.rerun(job);
+                R.exit_code >= 0 && !R.timed_out && !R.term_sig &&
+                job.cov.path_hash(shared.virgin) == want) {
+                job.result = std::move(R);
+                continue; // pos now holds the next chunk
+            }
+            std::swap(in, cand);
+            pos += chunk;
+        }
+    }
+    return orig - in.size();
+}
+
+constexpr uint64_t kEdgeScore = 64;
+constexpr uint64_t kBucketScore = 8;
+constexpr uint64_t kValueScore = 2;
+constexpr int kStabilityRuns = 3;
+
+// "12.3%"
+static std::string percent(const double frac) {
+    const auto tenths = static_cast<int>(1000 * frac + 0.5);
+    return std::to_string(tenths / 10) + "." + std::to_string(tenths % 10) +
+        "%";
+}
+
+// Share of seen counters that behave the same on every run.
+static std::string stability(const Shared& shared) {
+    const size_t seen = shared.virgin.count(
+        0, Coverage::map_size() + kCovValueSize);
+    const size_t variable = std::min(shared.virgin.variable_count(), seen);
+    return percent(seen ? static_cast<double>(seen - variable) /
+                   static_cast<double>(seen) : 1.0);
+}
+
+// Re-runs a novel input and marks every counter whose bucket differs
+// between runs as variable. False when all of the run's fresh counters
+// turned out to be variable, i.e. its novelty was noise.
+static bool stable_novelty(Shared& shared, AsyncExecutor& exec,
+                           AsyncExecutor::Job& job,
+                           const std::vector<uint32_t>& fresh) {
+    std::vector<uint32_t> first, again;
+    job.cov.entries(first);
+    for (int i = 1; i < kStabilityRuns; ++i) {
+        if (const ExecResult R = exec.rerun(job);
+            R.exit_code < 0 || R.timed_out || R.term_sig) {
+            break;
+        }
+        again.clear();
+        job.cov.entries(again);
+        size_t a = 0, b = 0;
+        while (a < first.size() || b < again.size()) {
+            const uint32_t ia = a < first.size() ? first[a] >> 8 : UINT32_MAX;
+            const uint32_t ib = b < again.size() ? again[b] >> 8 : UINT32_MAX;
+            if (ia == ib && first[a] != again[b]) {
+                shared.virgin.mark_variable(ia);
+            } else if (ia != ib) {
+                shared.virgin.mark_variable(std::min(ia, ib));
+            }
+            a += ia <= ib;
+            b += ib <= ia;
+        }
+    }
+    return std::ranges::any_of(fresh, [&](const uint32_t idx) {
+        return !shared.virgin.is_variable(idx);
+    });
+}
+
+// Triage one finished run: save new crash signatures, otherwise keep
+// inputs that reached new edges. lottery drives the occasional random keep.
+static void evaluate(Shared& shared, const std::string& out_dir,
+                     std::atomic<uint64_t>& crash_id,
+                     const std::vector<int>& allowed, AsyncExecutor& exec,
+                     AsyncExecutor::Job& job, const uint64_t lottery) {
+    std::vector<uint8_t>& test = job.input;
+    const ExecResult& R = job.result;
+    Coverage& cov = job.cov;
+    CrashInfo C = analyze_and_sig(R.exit_code, R.term_sig, R.timed_out, R.out,
+                                  R.err, allowed);
+    if (C.crashed) {
+        std::lock_guard lk(shared.seen_mu);
+        if (shared.seen.insert(C.signature).second) {
+            const uint64_t id = crash_id.fetch_add(1);
+            save_crash(out_dir, id, test, R, C);
+            shared.saved.fetch_add(1);
+            logx::good(
+                "new crash sig=" + C.signature + " id=" +
+                std::to_string(id) + " reason=" + C.reason);
+        }
+        shared.crashes.fetch_add(1);
+        return;
+    }
+
+    // A path seen before cannot add coverage, so it skips the per-edge
+    // claim and scoring. Novelty that does not reproduce is dropped.
+    std::vector<uint32_t> fresh;
+    if (const CovDelta d = shared.paths.insert(cov.path_hash(shared.virgin))
+            ? cov.claim(shared.virgin, &fresh)
+            : CovDelta{};
+        d.new_edges + d.new_buckets + d.new_values > 0 &&
+        stable_novelty(shared, exec, job, fresh)) {
+        std::vector<uint32_t> edges = covered_edges(shared, cov);
+        const size_t trimmed = trim_input(shared, exec, job);
+        shared.trimmed.fetch_add(trimmed);
+        const uint64_t base_score = d.new_edges * kEdgeScore +
+            d.new_buckets * kBucketScore + d.new_values * kValueScore;
+        const uint64_t penalty = !test.empty()
+            ? test.size() / 64 + 1
+            : 1;
+        const uint32_t score = static_cast<uint32_t>(
+            std::max<uint64_t>(1, base_score / penalty));
+        const Input input = make_input(std::move(test));
+        if (const auto id = shared.corpus.add(
+                input, score, static_cast<uint32_t>(R.wall_us),
+                static_cast<uint32_t>(R.cpu_us), std::move(edges))) {
+            save_queue(out_dir, *id, *input, score, job.parent, d, R.wall_us,
+                       trimmed);
+        }
+        shared.tuner.add_sample(R.wall_us);
+        shared.new_cov_inputs.fetch_add(1);
+        return;
+    }
+    if ((lottery & 0x7FF) == 0) {
+        const Input input = make_input(std::move(test));
+        // Without edges of its own, the entry may be evicted right away.
+        if (const auto id = shared.corpus.add(input, 1)) {
+            save_queue(out_dir, *id, *input, 1, job.parent, {}, R.wall_us, 0);
+        }
+    }
+}
+
+constexpr size_t kI2SLimit = 256;
+
+// Runs base once with compare logging, unless this worker already did, and
+// queues its input-to-state candidates.
+static void cmplog_stage(Executor& exec, CmpLog& cmplog,
+                         const std::vector<std::string>& argv_t,
+                         Mutator& mut, const std::vector<uint8_t>& base,
+                         std::unordered_set<uint64_t>& done,
+                         std::vector<std::vector<uint8_t>>& queue) {
+    const uint64_t h = std::hash<std::string_view>{}(std::string_view(
+        reinterpret_cast<const char*>(base.data()), base.size()));
+    if (!done.insert(h).second) {
+        return;
+    }
+    cmplog.reset();
+    if (const ExecResult R = exec.run(argv_t, base);
+        R.exit_code < 0 || R.timed_out) {
+        return;
+    }
+    mut.input_to_state(base, cmplog.pairs(), queue, kI2SLimit);
+}
+
+static Delivery parse_delivery(const std::string& mode) {
+    if (mode == "shm") {
+        return Delivery::Shm;
+    }
+    if (mode == "memfd") {
+        return Delivery::Memfd;
+    }
+    return Delivery::File;
+}
+
+static Capture parse_capture(const std::string& mode) {
+    if (mode == "discard") {
+        return Capture::Discard;
+    }
+    if (mode == "full") {
+        return Capture::Full;
+    }
+    return Capture::Tail;
+}
+
+static ExecConfig make_exec_config(const Options& opt,
+                                   const std::string& target_exe) {
+    ExecConfig ec;
+    ec.timeout_ms = opt.timeout_ms;
+    ec.mem_mb = opt.mem_mb;
+    if (opt.persistent > 0) {
+        ec.mode = ExecMode::Persistent;
+    } else if (opt.fork_server) {
+        ec.mode = ExecMode::ForkServer;
+    }
+    ec.persist_iters = opt.persistent;
+    ec.input_cap = opt.max_size;
+    ec.delivery = parse_delivery(opt.input_mode);
+    ec.exe_path = target_exe.c_str();
+    ec.capture = parse_capture(opt.capture);
+    ec.allowed_exits.assign(opt.allowed_exits.begin(),
+                            opt.allowed_exits.end());
+    return ec;
+}
+
 static bool preflight_target(const std::vector<std::string>& argv_t,
-                             std::string& err) {
+                             std::string& resolved, std::string& err) {
     if (argv_t.empty()) {
         err = "empty target";
         return false;
     }
     const std::string& exe = argv_t[0];
 
-    auto is_exec = [](const std::string& p) {
-        return access(p.c_str(), X_OK) == 0;
-    };
-
     if (exe.find('/') != std::string::npos) {
-        if (!is_exec(exe)) {
+        if (!resolve_executable(exe, resolved)) {
             err = "target not executable: " + exe + " (" + std::string(
                 std::strerror(errno)) + ")";
             return false;
         }
     } else {
-        const char* path = std::getenv("PATH");
-        if (!path) {
+        if (!std::getenv("PATH")) {
             err = "PATH is empty; cannot locate target: " + exe;
             return false;
         }
-        std::string p(path);
-        size_t pos = 0;
-        bool found = false;
-        while (pos <= p.size()) {
-            const size_t sep = p.find(':', pos);
-            if (std::string dir = p.substr(pos, sep == std::string::npos
-                                           ? p.size() - pos
-                                           : sep - pos); !dir.empty()) {
-                if (std::string full = join_path(dir, exe); is_exec(full)) {
-                    found = true;
-                    break;
-                }
-            }
-            if (sep == std::string::npos) {
-                break;
-            }
-            pos = sep + 1;
-        }
-        if (!found) {
+        if (!resolve_executable(exe, resolved)) {
             err = "cannot find target in PATH: " + exe;
             return false;
         }
@@ -216,6 +518,141 @@ static bool preflight_target(const std::vector<std::string>& argv_t,
     return true;
 }
 
+// Reads the "sig:" line of every crash sidecar in out_dir into seen and
+// returns the first crash id not taken yet.
+static uint64_t load_crash_sigs(const std::string& out_dir,
+                                std::unordered_set<std::string>& seen) {
+    uint64_t next = 0;
+    for (std::error_code ec; auto& p :
+         std::filesystem::directory_iterator(out_dir, ec)) {
+        const std::string name = p.path().filename().string();
+        if (!name.starts_with("crash-") || !name.ends_with(".meta.txt")) {
+            continue;
+        }
+        try {
+            next = std::max<uint64_t>(next, std::stoull(name.substr(6)) + 1);
+        } catch (...) {
+            continue;
+        }
+        std::ifstream f(p.path());
+        for (std::string line; std::getline(f, line);) {
+            if (line.starts_with("sig: ")) {
+                seen.insert(line.substr(5));
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+struct QueuedInput {
+    uint64_t id = 0;
+    Input input;
+    uint32_t score = 1;
+    uint32_t exec_us = 0;
+    std::vector<uint32_t> edges;
+    bool ok = false;
+};
+
+// Reads the id-<id> inputs of a queue directory and the scores in their
+// sidecars, in id order.
+static std::vector<QueuedInput> load_queue(const std::string& dir) {
+    std::vector<QueuedInput> queue;
+    for (std::error_code ec; auto& p :
+         std::filesystem::directory_iterator(dir, ec)) {
+        const std::string name = p.path().filename().string();
+        if (!name.starts_with("id-") || name.ends_with(".meta.txt")) {
+            continue;
+        }
+        QueuedInput q;
+        try {
+            q.id = std::stoull(name.substr(3));
+        } catch (...) {
+            continue;
+        }
+        std::ifstream ifs(p.path(), std::ios::binary);
+        q.input = make_input({std::istreambuf_iterator(ifs), {}});
+        std::ifstream mf(p.path().string() + ".meta.txt");
+        for (std::string line; std::getline(mf, line);) {
+            if (line.starts_with("score: ")) {
+                q.score = static_cast<uint32_t>(
+                    std::strtoul(line.c_str() + 7, nullptr, 10));
+            }
+        }
+        if (!q.input->empty()) {
+            queue.push_back(std::move(q));
+        }
+    }
+    std::ranges::sort(queue, {}, &QueuedInput::id);
+    return queue;
+}
+
+// Replays a loaded queue on opt.threads executors to rebuild the virgin
+// map and path set, then restores the entries under their recorded ids.
+// Returns how many came back.
+static size_t replay_queue(Shared& shared, const Options& opt,
+                           const std::string& target_exe,
+                           const std::vector<std::string>& argv_t,
+                           std::vector<QueuedInput>& queue) {
+    ExecConfig ec = make_exec_config(opt, target_exe);
+    ec.timeout_ms = shared.tuner.timeout_ms();
+    ec.capture = Capture::Discard;
+    ec.hang_ms = 0;
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> replay;
+    for (int t = 0; t < opt.threads; ++t) {
+        replay.emplace_back([&] {
+            AsyncExecutor exec(opt.inflight, ec, argv_t);
+            if (!exec.setup()) {
+                logx::warn("failed to setup coverage (resume)");
+                return;
+            }
+            while (true) {
+                while (exec.can_submit()) {
+                    const size_t i = next.fetch_add(1);
+                    if (i >= queue.size()) {
+                        break;
+                    }
+                    exec.submit({queue[i].input->begin(),
+                                 queue[i].input->end()}, i);
+                }
+                AsyncExecutor::Job* job = exec.complete();
+                if (!job) {
+                    break;
+                }
+                if (const ExecResult& R = job->result;
+                    R.exit_code >= 0 && !R.timed_out) {
+                    QueuedInput& q = queue[job->tag];
+                    shared.paths.insert(job->cov.path_hash(shared.virgin));
+                    job->cov.claim(shared.virgin);
+                    q.edges = covered_edges(shared, job->cov);
+                    q.exec_us = static_cast<uint32_t>(R.wall_us);
+                    q.ok = true;
+                    shared.tuner.add_sample(R.wall_us);
+                }
+                exec.release(job);
+            }
+        });
+    }
+    for (auto& th : replay) {
+        th.join();
+    }
+
+    size_t n = 0;
+    for (QueuedInput& q : queue) {
+        if (q.ok) {
+            shared.corpus.restore(q.id, q.input, q.score, q.exec_us,
+                                  std::move(q.edges));
+            ++n;
+        }
+    }
+    if (n < queue.size()) {
+        logx::warn(std::to_string(queue.size() - n) +
+                   " queue entries failed or timed out on replay");
+    }
+    return n;
+}
+
 int main(int argc, char** argv) {
     Options opt;
     if (std::string err; !parse_options(argc, argv, opt, err)) {
@@ -226,9 +663,24 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    std::filesystem::create_directories(opt.out_dir);
+    const std::string queue_dir = join_path(opt.out_dir, "queue");
+    std::filesystem::create_directories(queue_dir);
 
-    Shared shared(opt.max_size);
+    Shared shared(opt.max_size, opt.timeout_ms);
+    // Queue files are named by corpus id; seeds are numbered after the
+    // resumed ones, and a fresh campaign must not overwrite an old queue.
+    std::vector<QueuedInput> queue;
+    if (opt.resume) {
+        queue = load_queue(queue_dir);
+        if (!queue.empty()) {
+            shared.corpus.set_next_id(queue.back().id + 1);
+        }
+    } else if (std::error_code ec;
+               !std::filesystem::is_empty(queue_dir, ec) && !ec) {
+        logx::warn(queue_dir + " holds an earlier campaign; pass --resume "
+                   "to continue it or clear it");
+        return 1;
+    }
     if (!shared.corpus.load_dir(opt.seeds_dir)) {
         logx::warn("failed to load seeds");
         return 1;
@@ -248,117 +700,213 @@ int main(int argc, char** argv) {
         logx::warn("empty target");
         return 1;
     }
-    if (std::string terr; !preflight_target(argv_template, terr)) {
+    std::string target_exe;
+    if (std::string terr; !preflight_target(argv_template, target_exe, terr)) {
         logx::warn(terr);
         return 1;
     }
 
+    ExecConfig calib_ec = make_exec_config(opt, target_exe);
+    calib_ec.capture = Capture::Discard;
+    calib_ec.hang_ms = 0;
+    {
+        // One probe run at the default size learns the target's guard or
+        // inline counter count; everything after maps the size it asks for.
+        Coverage probe;
+        if (!probe.setup()) {
+            logx::warn("failed to setup coverage (probe)");
+            return 1;
+        }
+        ExecConfig ec = calib_ec;
+        ec.cov_shm_name = probe.shm_name().c_str();
+        ec.cov = &probe;
+        ec.timeout_ms = kCalibLimitMs;
+        Executor exec(std::move(ec));
+        (void)exec.run(argv_template, *shared.corpus.get_all_items().front());
+
+        const uint32_t guards = probe.guard_count();
+        const bool direct = probe.inline_counters();
+        Coverage::set_map_size(pick_map_size(guards, direct));
+        Coverage::set_value_profile(opt.value_profile);
+        std::string msg = "coverage map: " +
+            std::to_string(Coverage::map_size()) + " bytes";
+        if (guards) {
+            msg += " for " + std::to_string(guards) +
+                (direct ? " inline counters" : " guards");
+            if (probe.func_count()) {
+                msg += " (" + std::to_string(probe.func_count()) +
+                    " functions)";
+            }
+            msg += ", ~" + percent(collision_rate(
+                guards, Coverage::map_size(), direct)) + " collisions";
+        } else {
+            msg += " (target reported no guards)";
+        }
+        logx::info(msg);
+    }
+    {
+        Coverage cov;
+        if (!cov.setup()) {
+            logx::warn("failed to setup coverage (calibration)");
+            return 1;
+        }
+        calib_ec.cov_shm_name = cov.shm_name().c_str();
+        calib_ec.cov = &cov;
+        Executor exec(calib_ec);
+        calibrate_corpus(shared.corpus, exec, cov, argv_template,
+                         shared.tuner);
+    }
+
     const uint64_t global_seed = opt.seed ? opt.seed : seed_from_os();
     logx::info("seed: " + std::to_string(global_seed));
+    logx::info(std::string("coverage kernel: ") + Coverage::kernel_name());
+
+    std::vector<int> cpus;
+    if (opt.bind) {
+        if (!opt.cpu_list.empty()) {
+            if (!parse_cpu_list(opt.cpu_list, cpus)) {
+                logx::warn("bad --cpu list: " + opt.cpu_list);
+                return 1;
+            }
+        } else {
+            cpus = free_cpus();
+        }
+        if (cpus.size() < static_cast<size_t>(opt.threads)) {
+            logx::warn("only " + std::to_string(cpus.size()) +
+                       " free core(s) for " + std::to_string(opt.threads) +
+                       " workers; the rest stay unbound");
+        }
+    }
 
     std::atomic<uint64_t> crash_id{0};
+    if (opt.resume) {
+        const uint64_t t0 = now_mono_ms();
+        crash_id = load_crash_sigs(opt.out_dir, shared.seen);
+        const size_t n =
+            replay_queue(shared, opt, target_exe, argv_template, queue);
+        logx::info("resumed " + std::to_string(n) + " queue entries and " +
+                   std::to_string(shared.seen.size()) +
+                   " crash signatures in " +
+                   std::to_string(now_mono_ms() - t0) + " ms");
+    }
     std::vector<std::thread> workers;
 
     workers.reserve(opt.threads);
     for (int t = 0; t < opt.threads; t++) {
         workers.emplace_back([&, t] {
-            Coverage cov;
-            if (!cov.setup()) {
-                logx::warn("failed to setup coverage (worker)");
-                return;
+            // Pin before any per-worker allocation so buffers and the
+            // coverage shm are first touched on the local NUMA node.
+            if (static_cast<size_t>(t) < cpus.size()) {
+                if (pin_thread(cpus[t])) {
+                    logx::info("worker " + std::to_string(t) + " -> cpu " +
+                               std::to_string(cpus[t]));
+                } else {
+                    logx::warn("failed to bind worker " + std::to_string(t) +
+                               " to cpu " + std::to_string(cpus[t]));
+                }
             }
-            const uint64_t seed = global_seed ^ 0x9e3779b97f4a7c15ULL +
-                static_cast<uint64_t>(t) * 0x5851f42d4c957f2dULL;
+            const uint64_t seed = global_seed ^ (0x9e3779b97f4a7c15ULL +
+                static_cast<uint64_t>(t) * 0x5851f42d4c957f2dULL);
             Mutator mut(seed, opt.max_size,
                         dict.tokens.empty() ? nullptr : &dict);
-            const Executor exec(ExecConfig{opt.timeout_ms, opt.mem_mb,
-                                           cov.shm_name().c_str()});
             const std::vector allowed(opt.allowed_exits.begin(),
                                       opt.allowed_exits.end());
-            std::vector<uint8_t> base_cache;
+            ExecConfig ec = make_exec_config(opt, target_exe);
+            int timeout_ms = ec.timeout_ms = shared.tuner.timeout_ms();
+            if (!shared.tuner.fixed()) {
+                ec.hang_ms = kHangVerifyMs;
+            }
+            AsyncExecutor exec(opt.inflight, ec, argv_template);
+            if (!exec.setup()) {
+                logx::warn("failed to setup coverage (worker)");
+                return;
+            }
+            CmpLog cmplog;
+            Coverage cmp_cov;
+            std::unique_ptr<Executor> cmp_exec;
+            if (opt.cmplog) {
+                if (!cmplog.setup() || !cmp_cov.setup()) {
+                    logx::warn("failed to setup cmplog (worker)");
+                    return;
+                }
+                ExecConfig cc = ec;
+                cc.cov_shm_name = cmp_cov.shm_name().c_str();
+                cc.cov = &cmp_cov;
+                cc.cmplog_shm_name = cmplog.shm_name().c_str();
+                cc.capture = Capture::Discard;
+                cc.hang_ms = 0;
+                cmp_exec = std::make_unique<Executor>(std::move(cc));
+            }
+            std::unordered_set<uint64_t> cmp_done;
+            std::vector<std::vector<uint8_t>> i2s;
+            Input base_cache;
+            uint64_t base_id = 0;
             int energy_left = 0;
+            bool stop = false;
 
             while (true) {
-                const uint64_t done = shared.iter_done.fetch_add(1);
-                if (static_cast<int64_t>(done) >= opt.iterations) {
-                    break;
-                }
-                if (energy_left <= 0 || base_cache.empty()) {
-                    base_cache = shared.corpus.pick();
-                    energy_left = 16 + static_cast<int>(seed + done & 7);
-                }
-                std::vector<uint8_t> test;
-                if ((seed + done) % 5 == 0 && shared.corpus.size() >= 2) {
-                    auto other = shared.corpus.pick();
-                    test = mut.crossover(base_cache, other);
-                } else {
-                    test = mut.mutate(base_cache);
+                if (shared.tuner.timeout_ms() != timeout_ms) {
+                    timeout_ms = shared.tuner.timeout_ms();
+                    exec.set_timeout_ms(timeout_ms);
+                    if (cmp_exec) {
+                        cmp_exec->set_timeout_ms(timeout_ms);
+                    }
                 }
-                energy_left--;
-                cov.reset();
-                ExecResult R = exec.run(argv_template, test);
-                CrashInfo C = analyze_and_sig(R.exit_code, R.term_sig,
-                                              R.timed_out, R.out, R.err,
-                                              allowed);
-                if (C.crashed) {
-                    std::lock_guard lk(shared.seen_mu);
-                    if (shared.seen.insert(C.signature).second) {
-                        const uint64_t id = crash_id.fetch_add(1);
-                        save_crash(opt.out_dir, id, test, R, C);
-                        shared.saved.fetch_add(1);
-                        logx::good(
-                            "new crash sig=" + C.signature + " id=" +
-                            std::to_string(id) + " reason=" + C.reason);
+                while (!stop && exec.can_submit()) {
+                    const uint64_t done = shared.iter_done.fetch_add(1);
+                    if (static_cast<int64_t>(done) >= opt.iterations) {
+                        stop = true;
+                        break;
                     }
-                    shared.crashes.fetch_add(1);
-                } else {
-                    std::vector<uint32_t> edges;
-                    if (const size_t local_new = cov.collect_new_edges(&edges);
-                        local_new > 0) {
-                        size_t real_new = 0;
-                        {
-                            std::lock_guard lk(shared.cov_mu);
-                            for (uint32_t e : edges) {
-                                if (!shared.global_cov[e]) {
-                                    shared.global_cov[e] = 1;
-                                    real_new++;
-                                }
-                            }
-                        }
-                        if (real_new > 0) {
-                            cov.merge();
-                            const uint64_t base_score = real_new * 64;
-                            const uint64_t penalty = !test.empty()
-                                ? test.size() / 64 + 1
-                                : 1;
-                            const uint32_t score = static_cast<uint32_t>(
-                                std::max<uint64_t>(1, base_score / penalty));
-                            shared.corpus.add(test, score);
-                            shared.new_cov_inputs.fetch_add(1);
-                        } else {
-                            if ((seed + done & 0x7FF) == 0) {
-                                shared.corpus.add(test, 1);
-                            }
+                    if (!i2s.empty()) {
+                        exec.submit(std::move(i2s.back()), done, base_id);
+                        i2s.pop_back();
+                        continue;
+                    }
+                    if (energy_left <= 0 || !base_cache) {
+                        base_cache = shared.corpus.pick(&base_id);
+                        energy_left = 16 + static_cast<int>((seed + done) & 7);
+                        if (cmp_exec) {
+                            cmplog_stage(*cmp_exec, cmplog, argv_template, mut,
+                                         *base_cache, cmp_done, i2s);
                         }
+                    }
+                    std::vector<uint8_t> test;
+                    if ((seed + done) % 5 == 0 && shared.corpus.size() >= 2) {
+                        const Input other = shared.corpus.pick();
+                        test = mut.crossover(*base_cache, *other);
                     } else {
-                        if ((seed + done & 0x7FF) == 0) {
-                            shared.corpus.add(test, 1);
-                        }
+                        test = mut.mutate(*base_cache);
                     }
+                    energy_left--;
+                    exec.submit(std::move(test), done, base_id);
                 }
+
+                AsyncExecutor::Job* job = exec.complete();
+                if (!job) {
+                    break;
+                }
+                const uint64_t done = job->tag;
+                evaluate(shared, opt.out_dir, crash_id, allowed, exec, *job,
+                         seed + done);
+                exec.release(job);
+
                 if ((done + 1) % 1000 == 0) {
                     logx::info(
                         "iter " + std::to_string(done + 1) + "/" +
                         std::to_string(opt.iterations) + " crashes=" +
                         std::to_string(shared.crashes.load()) + " saved=" +
                         std::to_string(shared.saved.load()) + " seeds=" +
-                        std::to_string(shared.corpus.size()) + " cov=" +
-                        std::to_string(shared.new_cov_inputs.load()));
+                        std::to_string(shared.corpus.size()) + " favored=" +
+                        std::to_string(shared.corpus.favored()) + " cov=" +
+                        std::to_string(shared.new_cov_inputs.load()) +
+                        " paths=" + std::to_string(shared.paths.size()) +
+                        " stability=" + stability(shared));
                     auto items = shared.corpus.get_all_items();
                     std::stringstream ss;
                     ss << "Corpus content (size=" << items.size() << "):\n";
                     for (size_t i = 0; i < items.size(); ++i) {
-                        const auto& item = items[i];
+                        const auto& item = *items[i];
                         ss << "  [" << i << "] size=" << item.size() <<
                             " data=\"";
                         for (const auto& byte : item) {
@@ -380,10 +928,17 @@ int main(int argc, char** argv) {
         th.join();
     }
 
+    const size_t map = Coverage::map_size();
     logx::info(
         "done. total=" + std::to_string(shared.iter_done.load()) + " crashes=" +
         std::to_string(shared.crashes.load()) + " saved=" +
         std::to_string(shared.saved.load()) + " cov=" + std::to_string(
-            shared.new_cov_inputs.load()));
+            shared.new_cov_inputs.load()) + " trimmed=" + std::to_string(
+            shared.trimmed.load()) + "B paths=" + std::to_string(
+            shared.paths.size()) + " edges=" + std::to_string(
+            shared.virgin.count(0, map)) + (opt.value_profile
+            ? " values=" + std::to_string(
+                shared.virgin.count(map, map + kCovValueSize))
+            : std::string()) + " stability=" + stability(shared));
     return 0;
 }
@@ -22,38 +22,37 @@ static const std::vector<std::vector<uint8_t>>& fallback_dict() {
 Mutator::Mutator(const uint64_t seed, const size_t max_size, const Dict* dict) :
     rng_(seed), max_size_(max_size), dict_(dict) {}
 
-std::vector<uint8_t> Mutator::mutate(const std::vector<uint8_t>& in) {
-    auto cur = in;
+std::vector<uint8_t> Mutator::mutate(const std::span<const uint8_t> in) {
+    // The only copy of in; every stacked mutation edits it in place.
+    std::vector<uint8_t> cur(in.begin(), in.end());
     const int n = static_cast<int>(rng_() % 4) + 1;
     for (int k = 0; k < n; k++) {
         switch (rng_() % 9) {
         case 0:
-            cur = flip_bits(cur);
+            flip_bits(cur);
             break;
         case 1:
-            cur = insert_bytes(cur);
+            insert_bytes(cur);
             break;
         case 2:
-            cur = delete_bytes(cur);
+            delete_bytes(cur);
             break;
         case 3:
-            cur = replace_bytes(cur);
+            replace_bytes(cur);
             break;
         case 4:
         case 8:
-            cur = insert_dict(cur);
+            insert_dict(cur);
             break;
         case 5: {
             if (cur.empty()) {
                 cur = {0};
                 break;
             }
-            auto out = cur;
-            std::uniform_int_distribution<size_t> pos(0, out.size() - 1);
+            std::uniform_int_distribution<size_t> pos(0, cur.size() - 1);
             const size_t p = pos(rng_);
             const int delta = static_cast<int>(rng_() % 5) - 2;
-            out[p] = static_cast<uint8_t>(out[p] + delta);
-            cur = out;
+            cur[p] = static_cast<uint8_t>(cur[p] + delta);
             break;
         }
         case 6: {
@@ -64,40 +63,36 @@ std::vector<uint8_t> Mutator::mutate(const std::vector<uint8_t>& in) {
                 cur = {0};
                 break;
             }
-            auto out = cur;
             std::uniform_int_distribution<size_t>
                 val(0, std::size(interesting) - 1);
             uint32_t v = interesting[val(rng_)];
-            if (out.size() >= 4 && (rng_() & 1)) {
-                std::uniform_int_distribution<size_t> pos(0, out.size() - 4);
+            if (cur.size() >= 4 && (rng_() & 1)) {
+                std::uniform_int_distribution<size_t> pos(0, cur.size() - 4);
                 const size_t p = pos(rng_);
-                std::memcpy(&out[p], &v, 4);
-            } else if (out.size() >= 2 && (rng_() & 1)) {
-                std::uniform_int_distribution<size_t> pos(0, out.size() - 2);
+                std::memcpy(&cur[p], &v, 4);
+            } else if (cur.size() >= 2 && (rng_() & 1)) {
+                std::uniform_int_distribution<size_t> pos(0, cur.size() - 2);
                 const size_t p = pos(rng_);
                 auto vv = static_cast<uint16_t>(v);
-                std::memcpy(&out[p], &vv, 2);
+                std::memcpy(&cur[p], &vv, 2);
             } else {
-                std::uniform_int_distribution<size_t> pos(0, out.size() - 1);
+                std::uniform_int_distribution<size_t> pos(0, cur.size() - 1);
                 const size_t p = pos(rng_);
-                out[p] = static_cast<uint8_t>(v);
+                cur[p] = static_cast<uint8_t>(v);
             }
-            cur = out;
             break;
         }
         case 7: {
-            auto out = cur.empty() ? std::vector<uint8_t>{0} : cur;
+            if (cur.empty()) {
+                cur = {0};
+            }
             const auto byte = static_cast<uint8_t>(rng_() & 0xFF);
-            const size_t len = std::min<size_t>(out.empty() ? 1 : out.size(),
-                                                rng_() % 16 + 1);
-            std::uniform_int_distribution<size_t> pos(0, !out.empty()
-                ? out.size() - 1
-                : 0);
+            const size_t len = std::min<size_t>(cur.size(), rng_() % 16 + 1);
+            std::uniform_int_distribution<size_t> pos(0, cur.size() - 1);
             const size_t p = pos(rng_);
-            for (size_t i = 0; i < len && p + i < out.size(); ++i) {
-                out[p + i] = byte;
+            for (size_t i = 0; i < len && p + i < cur.size(); ++i) {
+                cur[p + i] = byte;
             }
-            cur = out;
             break;
         }
         default: ;
@@ -112,13 +107,14 @@ std::vector<uint8_t> Mutator::mutate(const std::vector<uint8_t>& in) {
     return cur;
 }
 
-std::vector<uint8_t> Mutator::crossover(
-    const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+std::vector<uint8_t> Mutator::crossover(const std::span<const uint8_t> a,
+                                        const std::span<const uint8_t> b) {
     if (a.empty()) {
-        return b.empty() ? std::vector{static_cast<uint8_t>(rng_() & 0xFF)} : b;
+        return b.empty() ? std::vector{static_cast<uint8_t>(rng_() & 0xFF)}
+                         : std::vector(b.begin(), b.end());
     }
     if (b.empty()) {
-        return a;
+        return {a.begin(), a.end()};
     }
     std::uniform_int_distribution<size_t> ia(0, a.size());
     std::uniform_int_distribution<size_t> ib(0, b.size());
@@ -135,6 +131,60 @@ std::vector<uint8_t> Mutator::crossover(
     return res;
 }
 
+// Operand values of size bytes with their byte order reversed.
+static uint64_t swap_bytes(const uint64_t v, const uint32_t size) {
+    return __builtin_bswap64(v) >> (64 - size * 8);
+}
+
+void Mutator::input_to_state(const std::span<const uint8_t> in,
+                             std::vector<CmpPair> pairs,
+                             std::vector<std::vector<uint8_t>>& out,
+                             const size_t limit) {
+    // Matches per pattern; one-byte operands occur all over most inputs.
+    constexpr size_t kMaxHits = 4;
+    const size_t end = out.size() + limit;
+    std::ranges::shuffle(pairs, rng_);
+    for (const CmpPair& p : pairs) {
+        const uint32_t n = p.size;
+        if ((n != 1 && n != 2 && n != 4 && n != 8) || n > in.size()) {
+            continue;
+        }
+        for (const bool flip : {false, true}) {
+            const uint64_t pattern = flip ? p.b : p.a;
+            const uint64_t value = flip ? p.a : p.b;
+            for (const bool swapped : {false, true}) {
+                if (swapped && n == 1) {
+                    break;
+                }
+                const uint64_t pv = swapped ? swap_bytes(pattern, n) : pattern;
+                size_t hits = 0;
+                for (size_t i = 0; i + n <= in.size() && hits < kMaxHits;
+                     ++i) {
+                    if (std::memcmp(&in[i], &pv, n) != 0) {
+                        continue;
+                    }
+                    ++hits;
+                    for (const uint64_t delta : {0ULL, 1ULL, ~0ULL}) {
+                        uint64_t v = value + delta;
+                        if (swapped) {
+                            v = swap_bytes(v, n);
+                        }
+                        if (std::memcmp(&v, &pv, n) == 0) {
+                            continue;
+                        }
+                        std::vector cand(in.begin(), in.end());
+                        std::memcpy(&cand[i], &v, n);
+                        out.push_back(std::move(cand));
+                        if (out.size() >= end) {
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 std::vector<uint8_t> Mutator::rand_bytes(const size_t n) {
     std::vector<uint8_t> r(n);
     for (size_t i = 0; i < n; i++) {
@@ -143,62 +193,56 @@ std::vector<uint8_t> Mutator::rand_bytes(const size_t n) {
     return r;
 }
 
-std::vector<uint8_t> Mutator::flip_bits(const std::vector<uint8_t>& d) {
+void Mutator::flip_bits(std::vector<uint8_t>& d) {
     if (d.empty()) {
-        return {0};
+        d = {0};
+        return;
     }
-    auto out = d;
-    std::uniform_int_distribution<size_t> di(0, out.size() - 1);
+    std::uniform_int_distribution<size_t> di(0, d.size() - 1);
     const size_t idx = di(rng_);
     std::uniform_int_distribution bit(0, 7);
-    out[idx] ^= 1u << bit(rng_);
-    return out;
+    d[idx] ^= 1u << bit(rng_);
 }
 
-std::vector<uint8_t> Mutator::insert_bytes(const std::vector<uint8_t>& d) {
-    auto out = d;
+void Mutator::insert_bytes(std::vector<uint8_t>& d) {
     const auto ins = (rng_() % 32 + 1);
     auto r = rand_bytes(ins);
-    std::uniform_int_distribution<size_t> pos(0, out.size());
-    out.insert(out.begin() + static_cast<ptrdiff_t>(pos(rng_)), r.begin(),
-               r.end());
-    if (out.size() > max_size_) {
-        out.resize(max_size_);
+    std::uniform_int_distribution<size_t> pos(0, d.size());
+    d.insert(d.begin() + static_cast<ptrdiff_t>(pos(rng_)), r.begin(),
+             r.end());
+    if (d.size() > max_size_) {
+        d.resize(max_size_);
     }
-    return out;
 }
 
-std::vector<uint8_t> Mutator::delete_bytes(const std::vector<uint8_t>& d) {
+void Mutator::delete_bytes(std::vector<uint8_t>& d) {
     if (d.empty()) {
-        return d;
+        return;
     }
-    auto out = d;
-    std::uniform_int_distribution<size_t> start(0, out.size() - 1);
+    std::uniform_int_distribution<size_t> start(0, d.size() - 1);
     const size_t s = start(rng_);
-    const size_t len = rng_() % std::min<size_t>(16, out.size() - s) + 1;
-    out.erase(out.begin() + static_cast<ptrdiff_t>(s),
-              out.begin() + static_cast<ptrdiff_t>(s + len));
-    if (out.empty()) {
-        out.push_back(static_cast<uint8_t>(rng_() & 0xFF));
+    const size_t len = rng_() % std::min<size_t>(16, d.size() - s) + 1;
+    d.erase(d.begin() + static_cast<ptrdiff_t>(s),
+            d.begin() + static_cast<ptrdiff_t>(s + len));
+    if (d.empty()) {
+        d.push_back(static_cast<uint8_t>(rng_() & 0xFF));
     }
-    return out;
 }
 
-std::vector<uint8_t> Mutator::replace_bytes(const std::vector<uint8_t>& d) {
+void Mutator::replace_bytes(std::vector<uint8_t>& d) {
     if (d.empty()) {
-        return rand_bytes(1);
+        d = rand_bytes(1);
+        return;
     }
-    auto out = d;
-    std::uniform_int_distribution<size_t> start(0, out.size() - 1);
+    std::uniform_int_distribution<size_t> start(0, d.size() - 1);
     const size_t s = start(rng_);
-    const size_t len = rng_() % std::min<size_t>(16, out.size() - s) + 1;
-    auto r = rand_bytes(len);
-    std::ranges::copy(r, out.begin() + static_cast<ptrdiff_t>(s));
-    return out;
+    const size_t len = rng_() % std::min<size_t>(16, d.size() - s) + 1;
+    for (size_t i = 0; i < len; ++i) {
+        d[s + i] = static_cast<uint8_t>(rng_() & 0xFF);
+    }
 }
 
-std::vector<uint8_t> Mutator::insert_dict(const std::vector<uint8_t>& d) {
-    auto out = d;
+void Mutator::insert_dict(std::vector<uint8_t>& d) {
     const std::vector<std::vector<uint8_t>>* src = nullptr;
     if (dict_ && !dict_->tokens.empty()) {
         src = &dict_->tokens;
@@ -206,14 +250,13 @@ std::vector<uint8_t> Mutator::insert_dict(const std::vector<uint8_t>& d) {
         src = &fallback_dict();
     }
     const auto idx = rng_() % src->size();
-    std::uniform_int_distribution<size_t> pos(0, out.size());
+    std::uniform_int_distribution<size_t> pos(0, d.size());
     const auto& tok = (*src)[idx];
-    out.insert(out.begin() + static_cast<ptrdiff_t>(pos(rng_)), tok.begin(),
-               tok.end());
-    if (out.size() > max_size_) {
-        out.resize(max_size_);
+    d.insert(d.begin() + static_cast<ptrdiff_t>(pos(rng_)), tok.begin(),
+             tok.end());
+    if (d.size() > max_size_) {
+        d.resize(max_size_);
     }
-    return out;
 }
 
 bool load_dict(const std::string& path, Dict& d) {
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <random>
 #include <sstream>
+#include <unistd.h>
 #include <sys/stat.h>
 
 std::vector<std::string> split_cmdline(const std::string& s) {
@@ -76,6 +77,12 @@ uint64_t now_mono_ms() {
         count();
 }
 
+uint64_t now_mono_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).
+        count();
+}
+
 int mktemp_file(std::string& path, const std::string& prefix) {
     path = "/tmp/" + prefix + ".XXXXXX";
     std::vector buf(path.begin(), path.end());
@@ -88,6 +95,36 @@ int mktemp_file(std::string& path, const std::string& prefix) {
     return fd;
 }
 
+bool resolve_executable(const std::string& exe, std::string& full) {
+    if (exe.find('/') != std::string::npos) {
+        full = exe;
+        return access(exe.c_str(), X_OK) == 0;
+    }
+    const char* path = std::getenv("PATH");
+    if (!path) {
+        return false;
+    }
+    const std::string p(path);
+    size_t pos = 0;
+    while (pos <= p.size()) {
+        const size_t sep = p.find(':', pos);
+        if (std::string dir = p.substr(pos, sep == std::string::npos
+                                       ? p.size() - pos
+                                       : sep - pos); !dir.empty()) {
+            if (std::string cand = join_path(dir, exe);
+                access(cand.c_str(), X_OK) == 0) {
+                full = std::move(cand);
+                return true;
+            }
+        }
+        if (sep == std::string::npos) {
+            break;
+        }
+        pos = sep + 1;
+    }
+    return false;
+}
+
 uint64_t seed_from_os() {
     std::random_device rd;
     const uint64_t a = static_cast<uint64_t>(rd()) << 32 ^ rd();
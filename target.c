@@ -27,6 +27,31 @@ int vuln(char* str) {
     return 0;
 }
 
+#ifdef FUZZ_PERSISTENT
+int __fuzz_loop(unsigned int max_iters);
+const unsigned char* __fuzz_input(size_t* len);
+
+int main(int argc, char* argv[]) {
+    while (__fuzz_loop(1000)) {
+        char buf[70] = {0};
+        size_t len = 0;
+        const unsigned char* in = __fuzz_input(&len);
+        if (!in) {
+            gets(buf);
+        } else {
+            size_t i = 0;
+            while (i < len && in[i] != '\n') {
+                buf[i] = (char)in[i]; //与gets相同，不检查长度
+                i++;
+            }
+            buf[i] = '\0';
+        }
+        printf(buf);
+        vuln(buf);
+    }
+    return 0;
+}
+#else
 int main(int argc, char* argv[]) {
     char buf[70] = {0};
 
@@ -35,3 +60,4 @@ int main(int argc, char* argv[]) {
     vuln(buf);
     return 0;
 }
+#endif